@@ -34,6 +34,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +50,16 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+/* Most sectors to transfer per interrupt with READ MULTIPLE and
+   WRITE MULTIPLE. */
+#define MAX_MULTIPLE 16
+
+/* Most sectors that a single command can transfer. */
+#define MAX_COMMAND_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +68,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt with READ
+                                   MULTIPLE and WRITE MULTIPLE, or 0
+                                   if they are not supported. */
   };
 
 /* An ATA channel (aka controller).
@@ -85,7 +99,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -136,6 +150,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
         }
 
       /* Register interrupt handler. */
@@ -303,6 +318,22 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Enable READ MULTIPLE and WRITE MULTIPLE, which transfer up
+     to MAX_MULTIPLE sectors per interrupt, if the disk supports
+     them.  Word 47 gives the most sectors it can transfer. */
+  d->multiple = *(uint16_t *) &id[47 * 2] & 0xff;
+  if (d->multiple > MAX_MULTIPLE)
+    d->multiple = MAX_MULTIPLE;
+  if (d->multiple > 0) 
+    {
+      select_device_wait (d);
+      outb (reg_nsect (c), d->multiple);
+      issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d) || (inb (reg_status (c)) & STA_ERR))
+        d->multiple = 0;
+    }
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
@@ -347,7 +378,7 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
+  select_sectors (d, sec_no, 1);
   issue_pio_command (c, CMD_READ_SECTOR_RETRY);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
@@ -367,7 +398,7 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
+  select_sectors (d, sec_no, 1);
   issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
   if (!wait_while_busy (d))
     PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
@@ -376,24 +407,121 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   lock_release (&c->lock);
 }
 
+/* Reads the CNT sectors starting at SEC_NO from disk D, the I'th
+   one into BUFFERS[I], which must have room for BLOCK_SECTOR_SIZE
+   bytes.  Uses READ MULTIPLE, which interrupts once per
+   D->multiple sectors instead of once per sector, if D supports
+   it.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, void *const buffers[],
+                   size_t cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  size_t i;
+
+  if (d->multiple == 0) 
+    {
+      for (i = 0; i < cnt; i++)
+        ide_read (d, sec_no + i, buffers[i]);
+      return;
+    }
+
+  lock_acquire (&c->lock);
+  for (i = 0; i < cnt; )
+    {
+      size_t end = i + (cnt - i < MAX_COMMAND_SECTORS
+                        ? cnt - i : MAX_COMMAND_SECTORS);
+
+      select_sectors (d, sec_no + i, end - i);
+      issue_pio_command (c, CMD_READ_MULTIPLE);
+      while (i < end) 
+        {
+          size_t block_end = end - i < (size_t) d->multiple
+                             ? end : i + d->multiple;
+
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          for (; i < block_end; i++)
+            input_sector (c, buffers[i]);
+        }
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D, the I'th
+   one from BUFFERS[I], which must contain BLOCK_SECTOR_SIZE
+   bytes.  Uses WRITE MULTIPLE, which interrupts once per
+   D->multiple sectors instead of once per sector, if D supports
+   it.  Returns after the disk has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no,
+                    const void *const buffers[], size_t cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  size_t i;
+
+  if (d->multiple == 0) 
+    {
+      for (i = 0; i < cnt; i++)
+        ide_write (d, sec_no + i, buffers[i]);
+      return;
+    }
+
+  lock_acquire (&c->lock);
+  for (i = 0; i < cnt; )
+    {
+      size_t end = i + (cnt - i < MAX_COMMAND_SECTORS
+                        ? cnt - i : MAX_COMMAND_SECTORS);
+
+      select_sectors (d, sec_no + i, end - i);
+      issue_pio_command (c, CMD_WRITE_MULTIPLE);
+      while (i < end) 
+        {
+          size_t block_end = end - i < (size_t) d->multiple
+                             ? end : i + d->multiple;
+
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          for (; i < block_end; i++)
+            output_sector (c, buffers[i]);
+          sema_down (&c->completion_wait);
+        }
+    }
+  lock_release (&c->lock);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_COMMAND_SECTORS, to the disk's sector selection registers.
+   (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_COMMAND_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_COMMAND_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
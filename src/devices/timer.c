@@ -4,11 +4,11 @@
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
+#include "threads/cycles.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
-#include <list.h>
-  
+
 /* See [8254] for hardware details of the 8254 timer chip. */
 
 #if TIMER_FREQ < 19
@@ -18,15 +18,53 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-static struct list sleep_list;
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Threads blocked in timer_sleep(), kept in a leftist min-heap
+   ordered by wake-up time (struct thread's `endtime').  The heap
+   is threaded through the sleeping threads themselves, so adding
+   a sleeper and removing the earliest one both take O(log n)
+   time without any allocation, and timer_interrupt() only ever
+   looks at threads that are actually due. */
+static struct thread *sleep_heap;
+
+/* Cost of timer_interrupt(), for timer_get_irq_stats(). */
+static struct timer_irq_stats irq_stats;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* If false (default), the timer always interrupts TIMER_FREQ
+   times per second.
+   If true, the idle thread programs the PIT in one-shot mode for
+   the earliest sleeper's deadline instead.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles per timer tick. */
+#define PIT_CYCLES_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Longest one-shot period, in timer ticks, that fits in the
+   PIT's 16-bit counter.  About 5 ticks at 100 Hz. */
+#define ONESHOT_MAX_TICKS (65536 / PIT_CYCLES_PER_TICK)
+
+/* One-shot state.  While ONESHOT_TICKS is nonzero, the PIT is in
+   one-shot mode and will interrupt after ONESHOT_COUNT cycles,
+   at the end of the ONESHOT_TICKS'th tick from when it was
+   armed. */
+static int64_t oneshot_ticks;
+static unsigned oneshot_count;
+
+/* Idle statistics. */
+static bool idling;             /* In timer_idle_enter/exit window? */
+static int64_t idle_ticks;      /* # of timer ticks spent idle. */
+static int64_t idle_interrupts; /* # of timer interrupts while idle. */
+
 static intr_handler_func timer_interrupt;
+static void timer_advance (int64_t elapsed);
+static struct thread *sleep_heap_merge (struct thread *, struct thread *);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -37,8 +75,6 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
-  list_init (&sleep_list);
-//  printf("intiated\n");
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -93,21 +129,20 @@ timer_elapsed (int64_t then)
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct thread *cur = thread_current ();
   enum intr_level old_level;
-  old_level = intr_disable ();
-  thread_current ()->endtime = start + ticks;
- // printf("need to sleep, tid: %d, %d\n", thread_current ()->tid, start + ticks);
-  list_push_back (&sleep_list, &thread_current ()->elem);
-  thread_block();
-//  printf("escaped %d\n", thread_current ()->tid);
-  intr_set_level (old_level);
 
-/*
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
-    */
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  cur->endtime = timer_ticks () + ticks;
+  cur->sleep_left = cur->sleep_right = NULL;
+  cur->sleep_rank = 1;
+  sleep_heap = sleep_heap_merge (sleep_heap, cur);
+  thread_block ();
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -173,45 +208,211 @@ timer_ndelay (int64_t ns)
   real_time_delay (ns, 1000 * 1000 * 1000);
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU to wait for an interrupt.  In tickless mode, if
+   no sleeper is due within the next tick, switches the PIT to
+   one-shot mode so that the CPU is not woken until the earliest
+   deadline (or the longest period the PIT supports). */
+void
+timer_idle_enter (void) 
+{
+  int64_t delta;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  idling = true;
+  if (!timer_tickless || oneshot_ticks > 0)
+    return;
+
+  delta = sleep_heap != NULL ? sleep_heap->endtime - ticks : ONESHOT_MAX_TICKS;
+  if (delta > ONESHOT_MAX_TICKS)
+    delta = ONESHOT_MAX_TICKS;
+  if (delta <= 1)
+    return;
+
+  /* Keep the phase of the periodic tick: the first one-shot tick
+     ends where the current periodic tick would have. */
+  oneshot_ticks = delta;
+  oneshot_count = pit_read_counter (0) + (delta - 1) * PIT_CYCLES_PER_TICK;
+  pit_start_oneshot (0, oneshot_count);
+}
+
+/* Called by the idle thread right after an interrupt wakes it
+   up, and at the start of every external interrupt other than
+   the timer's, since that interrupt's handler may preempt the
+   idle thread before it runs.  Does nothing unless the idle
+   thread is between timer_idle_enter() and here.  If the
+   interrupt was not the one-shot expiring, accounts for the
+   whole ticks that have passed since timer_idle_enter() and arms
+   the PIT for the remainder of the current tick, so that `ticks'
+   stays correct and the periodic tick resumes with its original
+   phase. */
+void
+timer_idle_exit (void) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (!idling)
+    {
+      intr_set_level (old_level);
+      return;
+    }
+
+  if (oneshot_ticks > 0)
+    {
+      unsigned remaining = pit_read_counter (0);
+
+      /* A zero or wrapped-around counter means that the one-shot
+         period just expired and its interrupt is still pending:
+         timer_interrupt() will account for it. */
+      if (remaining != 0 && remaining <= oneshot_count)
+        {
+          int64_t future = DIV_ROUND_UP (remaining, PIT_CYCLES_PER_TICK);
+          int64_t elapsed = oneshot_ticks - future;
+
+          oneshot_ticks = 1;
+          oneshot_count = remaining - (future - 1) * PIT_CYCLES_PER_TICK;
+          pit_start_oneshot (0, oneshot_count);
+          timer_advance (elapsed);
+        }
+    }
+  idling = false;
+
+  intr_set_level (old_level);
+}
+
 /* Prints timer statistics. */
 void
 timer_print_stats (void) 
 {
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  if (idle_ticks > 0)
+    printf ("Timer: %"PRId64" interrupts in %"PRId64" idle ticks, "
+            "%"PRId64" per idle second\n",
+            idle_interrupts, idle_ticks,
+            idle_interrupts * TIMER_FREQ / idle_ticks);
+}
+
+/* Copies the accumulated cost of the timer interrupt handler
+   into *STATS. */
+void
+timer_get_irq_stats (struct timer_irq_stats *stats) 
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = irq_stats;
+  intr_set_level (old_level);
+}
+
+/* Resets the statistics returned by timer_get_irq_stats(). */
+void
+timer_reset_irq_stats (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  irq_stats.interrupts = 0;
+  irq_stats.wakeups = 0;
+  irq_stats.total_cycles = 0;
+  irq_stats.max_cycles = 0;
+  intr_set_level (old_level);
+}
+
+/* Returns the rank of leftist heap node T, that is, the length
+   of its rightmost path, or 0 for an empty heap. */
+static inline int
+sleep_heap_rank (const struct thread *t) 
+{
+  return t != NULL ? t->sleep_rank : 0;
+}
+
+/* Merges the sleep heaps rooted at A and B and returns the root
+   of the result.  Recursion follows only the right spines, whose
+   lengths are logarithmic in the heap sizes, so stack usage stays
+   small even with many sleepers. */
+static struct thread *
+sleep_heap_merge (struct thread *a, struct thread *b) 
+{
+  struct thread *t;
+
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (b->endtime < a->endtime)
+    {
+      t = a;
+      a = b;
+      b = t;
+    }
+
+  a->sleep_right = sleep_heap_merge (a->sleep_right, b);
+  if (sleep_heap_rank (a->sleep_left) < sleep_heap_rank (a->sleep_right))
+    {
+      t = a->sleep_left;
+      a->sleep_left = a->sleep_right;
+      a->sleep_right = t;
+    }
+  a->sleep_rank = sleep_heap_rank (a->sleep_right) + 1;
+  return a;
 }
 
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  
-  struct list_elem *e;
+  uint64_t start = rdtsc ();
+  int64_t elapsed = 1;
+  uint64_t cycles;
+
+  if (oneshot_ticks > 0)
+    {
+      /* After the one-shot period expires, the counter wraps
+         around and keeps counting down from 65535.  Otherwise,
+         this is a periodic tick that was already pending when
+         the one-shot was armed, and the one-shot keeps going. */
+      unsigned counter = pit_read_counter (0);
+      if (counter == 0 || counter > oneshot_count)
+        {
+          elapsed = oneshot_ticks;
+          oneshot_ticks = 0;
+          pit_configure_channel (0, 2, TIMER_FREQ);
+        }
+    }
+  if (idling)
+    idle_interrupts++;
 
+  timer_advance (elapsed);
+
+  cycles = rdtsc () - start;
+  irq_stats.interrupts++;
+  irq_stats.total_cycles += cycles;
+  if (cycles > irq_stats.max_cycles)
+    irq_stats.max_cycles = cycles;
+}
+
+/* Advances the tick count by ELAPSED ticks, waking up sleepers
+   and running the scheduler's per-tick work once for each tick in
+   turn.  Interrupts must be off. */
+static void
+timer_advance (int64_t elapsed) 
+{
   ASSERT (intr_get_level () == INTR_OFF);
 
- // printf("loop start\n");
-  for (e = list_begin (&sleep_list); e != list_end (&sleep_list);
-       e = list_next (e))
+  while (elapsed-- > 0)
     {
- //     printf("1");
-      struct thread *t = list_entry (e, struct thread, elem);
- //     printf("2");
-      if(t->endtime <= ticks)
+      ticks++;
+      if (idling)
+        idle_ticks++;
+
+      /* Wake up every sleeper that is due. */
+      while (sleep_heap != NULL && sleep_heap->endtime <= ticks)
         {
-          
-//  printf("need to wake up %d, %d, %d\n", t->tid, t->endtime, ticks);
- //         printf("3");
- //         printf("4");
-          e=list_remove(e);
-          e=e->prev;
-          thread_unblock(t);
-//          printf("5");
+          struct thread *t = sleep_heap;
+          sleep_heap = sleep_heap_merge (t->sleep_left, t->sleep_right);
+          thread_unblock (t);
+          irq_stats.wakeups++;
         }
-    }
-//  printf("loop end\n");
 
-  thread_tick ();
+      thread_tick ();
+    }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
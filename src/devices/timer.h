@@ -2,11 +2,16 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* If true, the idle thread stops the periodic tick.
+   Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
 
@@ -24,6 +29,22 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 void timer_print_stats (void);
 
+/* Cost of the timer interrupt handler. */
+struct timer_irq_stats
+  {
+    int64_t interrupts;         /* Number of timer interrupts. */
+    int64_t wakeups;            /* Sleeping threads woken up. */
+    uint64_t total_cycles;      /* CPU cycles spent in the handler. */
+    uint64_t max_cycles;        /* Most cycles spent in one interrupt. */
+  };
+
+void timer_get_irq_stats (struct timer_irq_stats *);
+void timer_reset_irq_stats (void);
+
 #endif /* devices/timer.h */
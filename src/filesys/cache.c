@@ -0,0 +1,556 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache.
+
+   All reads and writes of file system sectors go through a cache
+   of CACHE_CNT sectors.  A sector that is written stays in the
+   cache, marked dirty, until it is evicted or the cache is
+   flushed.  When a sector not in the cache is needed, a "clock"
+   hand sweeps the cache for a block to replace, clearing each
+   block's accessed bit and taking the first block whose bit was
+   already clear.
+
+   Writes are "write-behind": a background thread flushes the
+   cache every WRITE_BEHIND_TICKS timer ticks, and filesys_done()
+   flushes it one last time.  A flush writes the dirty sectors in
+   ascending order, each run of consecutive sectors in a single
+   request.  Evicting a dirty block likewise writes back the
+   dirty sectors next to it, so that one eviction under write
+   pressure cleans several blocks at once.
+
+   Reads can be "read-ahead": cache_read_ahead() queues a sector
+   that is likely to be read soon, and a background thread reads
+   it into the cache, together with the queued sectors that
+   follow it on disk, in a single request.
+
+   Each block has a lock that protects its data and flags.
+   cache_lock protects the hand and every block's `sector', which
+   is only changed while both locks are held, so that holding
+   either one is enough to read it.  A thread that finds its
+   sector in a block must acquire the block's lock and then check
+   that the block still holds that sector, since it may have been
+   replaced in the meantime. */
+
+/* Number of blocks in the cache. */
+#define CACHE_CNT 64
+
+/* `sector' of a block that holds no sector. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* Timer ticks between flushes by the write-behind thread. */
+#define WRITE_BEHIND_TICKS TIMER_FREQ
+
+/* Most sectors queued for read-ahead at once. */
+#define READ_AHEAD_CNT 32
+
+/* A cached sector. */
+struct cache_block
+  {
+    struct lock lock;                   /* Protects members below. */
+    block_sector_t sector;              /* Sector held, or NO_SECTOR. */
+    bool up_to_date;                    /* Has DATA been read? */
+    bool dirty;                         /* Must DATA be written? */
+    bool accessed;                      /* Used since hand passed? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector data. */
+  };
+
+/* Cache blocks. */
+static struct cache_block blocks[CACHE_CNT];
+
+/* Next block for the clock hand to examine. */
+static size_t hand;
+
+/* Protects `hand', each block's `sector', and the statistics. */
+static struct lock cache_lock;
+
+/* Statistics. */
+static long long hit_cnt;       /* Sectors found in the cache. */
+static long long miss_cnt;      /* Sectors not found in the cache. */
+static long long writeback_cnt; /* Dirty sectors written back. */
+static long long write_req_cnt; /* Requests to write them. */
+static long long read_ahead_cnt; /* Sectors read ahead. */
+
+/* Queue of sectors to read ahead, a circular buffer. */
+static block_sector_t read_ahead_queue[READ_AHEAD_CNT];
+static size_t read_ahead_head;  /* First queued sector. */
+static size_t read_ahead_size;  /* Number of queued sectors. */
+static struct lock read_ahead_lock;     /* Protects the queue. */
+static struct condition read_ahead_cond; /* Signaled when not empty. */
+
+static thread_func flusher NO_RETURN;
+static thread_func read_ahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void) 
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_cond);
+  for (i = 0; i < CACHE_CNT; i++) 
+    {
+      struct cache_block *b = &blocks[i];
+      lock_init (&b->lock);
+      b->sector = NO_SECTOR;
+      b->up_to_date = b->dirty = b->accessed = false;
+    }
+  thread_create ("flusher", PRI_DEFAULT, flusher, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Returns the block that holds SECTOR, or a null pointer if
+   there is none.  cache_lock must be held. */
+static struct cache_block *
+lookup (block_sector_t sector) 
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_CNT; i++)
+    if (blocks[i].sector == sector)
+      return &blocks[i];
+  return NULL;
+}
+
+/* Tries to lock block B without waiting.  Fails if B is locked,
+   including by the current thread, as it may be by the
+   read-ahead thread. */
+static bool
+try_lock_block (struct cache_block *b) 
+{
+  return (!lock_held_by_current_thread (&b->lock)
+          && lock_try_acquire (&b->lock));
+}
+
+/* Sweeps the clock hand around the cache looking for a block to
+   replace, and returns it, locked.  Returns a null pointer if
+   every block is locked by another thread.  cache_lock must be
+   held. */
+static struct cache_block *
+choose_victim (void) 
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  /* Two full turns of the hand are enough to find a block that
+     has not been accessed, unless every block is locked. */
+  for (i = 0; i < 2 * CACHE_CNT; i++) 
+    {
+      struct cache_block *b = &blocks[hand];
+      hand = (hand + 1) % CACHE_CNT;
+
+      if (!try_lock_block (b))
+        continue;
+      if (b->sector == NO_SECTOR || !b->accessed)
+        return b;
+      b->accessed = false;
+      lock_release (&b->lock);
+    }
+  return NULL;
+}
+
+/* Writes the CNT blocks in RUN, which must be locked, dirty, and
+   hold consecutive sectors in ascending order, to disk in a
+   single request.  Marks them clean and unlocks them. */
+static void
+write_run (struct cache_block *run[], size_t cnt) 
+{
+  const void *buffers[CACHE_CNT];
+  size_t i;
+
+  if (cnt == 0)
+    return;
+
+  for (i = 0; i < cnt; i++)
+    buffers[i] = run[i]->data;
+  block_write_multiple (fs_device, run[0]->sector, buffers, cnt);
+  for (i = 0; i < cnt; i++) 
+    {
+      run[i]->dirty = false;
+      lock_release (&run[i]->lock);
+    }
+
+  lock_acquire (&cache_lock);
+  writeback_cnt += cnt;
+  write_req_cnt++;
+  lock_release (&cache_lock);
+}
+
+/* Locks and stores in RUN the dirty block B, which is locked,
+   along with the dirty blocks that hold the sectors just before
+   and after it, in order of sector, stopping at the first sector
+   in each direction that is not cached, not dirty, or locked by
+   another thread.  Returns the number of blocks stored.
+   cache_lock must be held. */
+static size_t
+gather_run (struct cache_block *b, struct cache_block *run[]) 
+{
+  struct cache_block *c;
+  size_t before_cnt = 0;
+  size_t cnt;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  /* Gather the blocks before B, last one first, then put them in
+     order. */
+  while (before_cnt < CACHE_CNT - 1
+         && b->sector > before_cnt
+         && (c = lookup (b->sector - before_cnt - 1)) != NULL
+         && try_lock_block (c)) 
+    {
+      if (!c->dirty) 
+        {
+          lock_release (&c->lock);
+          break;
+        }
+      run[before_cnt++] = c;
+    }
+  for (i = 0; i < before_cnt / 2; i++) 
+    {
+      c = run[i];
+      run[i] = run[before_cnt - 1 - i];
+      run[before_cnt - 1 - i] = c;
+    }
+  cnt = before_cnt;
+  run[cnt++] = b;
+  while (cnt < CACHE_CNT
+         && (c = lookup (b->sector + (cnt - before_cnt))) != NULL
+         && try_lock_block (c)) 
+    {
+      if (!c->dirty) 
+        {
+          lock_release (&c->lock);
+          break;
+        }
+      run[cnt++] = c;
+    }
+  return cnt;
+}
+
+/* Returns the block that holds SECTOR, locked, replacing
+   another sector if SECTOR is not in the cache.  The block's
+   data has not necessarily been read: check `up_to_date'.
+   If READ_AHEAD is true, SECTOR is not needed yet, so the block
+   is not marked accessed, making it the first to go if it is not
+   used before the clock hand comes by, and it does not count as
+   a hit or miss. */
+static struct cache_block *
+cache_get (block_sector_t sector, bool read_ahead) 
+{
+  ASSERT (sector != NO_SECTOR);
+
+  for (;;) 
+    {
+      struct cache_block *b;
+
+      lock_acquire (&cache_lock);
+      b = lookup (sector);
+      if (b != NULL) 
+        {
+          if (!read_ahead)
+            hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&b->lock);
+          if (b->sector == sector) 
+            {
+              if (!read_ahead)
+                b->accessed = true;
+              return b;
+            }
+
+          /* Replaced while we waited for the lock. */
+          lock_release (&b->lock);
+          continue;
+        }
+
+      b = choose_victim ();
+      if (b == NULL) 
+        {
+          /* Every block is busy.  Wait for one, then try again.
+             If we hold the block ourselves, just let the others
+             run for a while. */
+          b = &blocks[hand];
+          lock_release (&cache_lock);
+          if (lock_held_by_current_thread (&b->lock))
+            thread_yield ();
+          else 
+            {
+              lock_acquire (&b->lock);
+              lock_release (&b->lock);
+            }
+          continue;
+        }
+
+      if (b->dirty) 
+        {
+          /* Write back the block's sector, along with any dirty
+             neighbors, without holding cache_lock.  Anyone who
+             wants one of those sectors in the meantime waits for
+             its block's lock.  write_run() unlocks B along with
+             the rest, so lock it again and make sure that no one
+             has used it in the meantime. */
+          struct cache_block *run[CACHE_CNT];
+          size_t cnt = gather_run (b, run);
+          block_sector_t old_sector = b->sector;
+
+          lock_release (&cache_lock);
+          write_run (run, cnt);
+          lock_acquire (&b->lock);
+          lock_acquire (&cache_lock);
+          if (b->sector != old_sector || b->dirty || b->accessed) 
+            {
+              /* Someone used B meanwhile, so it is no longer a
+                 good victim. */
+              lock_release (&b->lock);
+              lock_release (&cache_lock);
+              continue;
+            }
+
+          /* Someone else may have brought SECTOR in. */
+          if (lookup (sector) != NULL) 
+            {
+              lock_release (&b->lock);
+              lock_release (&cache_lock);
+              continue;
+            }
+        }
+
+      if (read_ahead)
+        read_ahead_cnt++;
+      else
+        miss_cnt++;
+      b->sector = sector;
+      b->up_to_date = false;
+      b->accessed = !read_ahead;
+      lock_release (&cache_lock);
+      return b;
+    }
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR
+   into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size) 
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  b = cache_get (sector, false);
+  if (!b->up_to_date) 
+    {
+      block_read (fs_device, sector, b->data);
+      b->up_to_date = true;
+    }
+  memcpy (buffer, b->data + ofs, size);
+  lock_release (&b->lock);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   offset OFS within the sector.  The sector is only written to
+   disk when it is evicted or the cache is flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size) 
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  b = cache_get (sector, false);
+  if (!b->up_to_date) 
+    {
+      /* No need to read a sector that is about to be entirely
+         overwritten. */
+      if (size < BLOCK_SECTOR_SIZE)
+        block_read (fs_device, sector, b->data);
+      b->up_to_date = true;
+    }
+  memcpy (b->data + ofs, buffer, size);
+  b->dirty = true;
+  lock_release (&b->lock);
+}
+
+/* Queues SECTOR to be read into the cache in the background, in
+   the expectation that it will be read soon.  Does nothing if
+   the read-ahead queue is full. */
+void
+cache_read_ahead (block_sector_t sector) 
+{
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_size < READ_AHEAD_CNT) 
+    {
+      read_ahead_queue[(read_ahead_head + read_ahead_size++)
+                       % READ_AHEAD_CNT] = sector;
+      cond_signal (&read_ahead_cond, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Reads the CNT blocks in RUN, which must be locked, not up to
+   date, and hold consecutive sectors in ascending order, from
+   disk in a single request.  Marks them up to date and unlocks
+   them. */
+static void
+read_run (struct cache_block *run[], size_t cnt) 
+{
+  void *buffers[READ_AHEAD_CNT];
+  size_t i;
+
+  if (cnt == 0)
+    return;
+
+  for (i = 0; i < cnt; i++)
+    buffers[i] = run[i]->data;
+  block_read_multiple (fs_device, run[0]->sector, buffers, cnt);
+  for (i = 0; i < cnt; i++) 
+    {
+      run[i]->up_to_date = true;
+      lock_release (&run[i]->lock);
+    }
+}
+
+/* Read-ahead thread.  Takes sectors off the read-ahead queue,
+   along with any that follow them directly on disk, and reads
+   those not already cached. */
+static void
+read_ahead_daemon (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      block_sector_t sectors[READ_AHEAD_CNT];
+      struct cache_block *run[READ_AHEAD_CNT];
+      size_t sector_cnt = 0;
+      size_t run_cnt = 0;
+      size_t i;
+
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_size == 0)
+        cond_wait (&read_ahead_cond, &read_ahead_lock);
+      do 
+        {
+          sectors[sector_cnt++] = read_ahead_queue[read_ahead_head];
+          read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_CNT;
+          read_ahead_size--;
+        }
+      while (read_ahead_size > 0
+             && (read_ahead_queue[read_ahead_head]
+                 == sectors[sector_cnt - 1] + 1));
+      lock_release (&read_ahead_lock);
+
+      /* Holding several blocks' locks at once is safe here because
+         no thread that holds a block's lock waits for another
+         block's lock, except this one. */
+      for (i = 0; i < sector_cnt; i++) 
+        {
+          struct cache_block *b = cache_get (sectors[i], true);
+          if (b->up_to_date) 
+            {
+              /* Already cached, so the run is broken. */
+              lock_release (&b->lock);
+              read_run (run, run_cnt);
+              run_cnt = 0;
+            }
+          else
+            run[run_cnt++] = b;
+        }
+      read_run (run, run_cnt);
+    }
+}
+
+/* Compares the sector numbers that A and B point to, for
+   qsort(). */
+static int
+compare_sectors (const void *a_, const void *b_) 
+{
+  const block_sector_t *a = a_;
+  const block_sector_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Writes every dirty sector in the cache to disk, in ascending
+   order, each run of consecutive sectors in a single request. */
+void
+cache_flush (void) 
+{
+  block_sector_t sectors[CACHE_CNT];
+  struct cache_block *run[CACHE_CNT];
+  size_t sector_cnt = 0;
+  size_t run_cnt = 0;
+  size_t i;
+
+  /* Make a sorted list of the sectors that appear to be dirty.
+     Reading `dirty' without the block's lock is only a hint; it
+     is checked again below. */
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_CNT; i++)
+    if (blocks[i].sector != NO_SECTOR && blocks[i].dirty)
+      sectors[sector_cnt++] = blocks[i].sector;
+  lock_release (&cache_lock);
+  qsort (sectors, sector_cnt, sizeof *sectors, compare_sectors);
+
+  for (i = 0; i < sector_cnt; i++) 
+    {
+      struct cache_block *b;
+
+      lock_acquire (&cache_lock);
+      b = lookup (sectors[i]);
+      lock_release (&cache_lock);
+      if (b == NULL)
+        continue;
+
+      /* Never wait for a block's lock while holding others. */
+      if (run_cnt == 0 || !lock_try_acquire (&b->lock)) 
+        {
+          write_run (run, run_cnt);
+          run_cnt = 0;
+          lock_acquire (&b->lock);
+        }
+      if (b->sector != sectors[i] || !b->dirty) 
+        {
+          lock_release (&b->lock);
+          continue;
+        }
+      if (run_cnt > 0 && run[run_cnt - 1]->sector + 1 != b->sector) 
+        {
+          write_run (run, run_cnt);
+          run_cnt = 0;
+        }
+      run[run_cnt++] = b;
+    }
+  write_run (run, run_cnt);
+}
+
+/* Write-behind thread.  Flushes the cache periodically, so that
+   little data is lost if the machine stops unexpectedly. */
+static void
+flusher (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      timer_sleep (WRITE_BEHIND_TICKS);
+      cache_flush ();
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void) 
+{
+  printf ("Buffer cache: %lld hits, %lld misses, %lld read ahead, "
+          "%lld writebacks in %lld requests\n",
+          hit_cnt, miss_cnt, read_ahead_cnt, writeback_cnt, write_req_cnt);
+}
@@ -1,7 +1,15 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
+
+/* Read-ahead window, in bytes.  A read that starts where the
+   previous one ended is "sequential" and asks for the next
+   READ_AHEAD_MIN bytes to be read ahead.  Each further
+   sequential read doubles the window, up to READ_AHEAD_MAX.  Any
+   other read closes the window. */
+#define READ_AHEAD_MIN (2 * BLOCK_SECTOR_SIZE)
+#define READ_AHEAD_MAX (16 * BLOCK_SECTOR_SIZE)
 
 /* An open file. */
 struct file 
@@ -9,26 +17,43 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Read-ahead. */
+    off_t next_ofs;             /* Where a sequential read starts. */
+    off_t ahead_ofs;            /* End of data already read ahead. */
+    off_t window;               /* Read-ahead window, or 0. */
   };
 
+/* Cache of `struct file's. */
+static struct kmem_cache file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void) 
+{
+  kmem_cache_init (&file_cache, "file", sizeof (struct file), NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (&file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->next_ofs = file->ahead_ofs = file->window = 0;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      if (file != NULL)
+        kmem_cache_free (&file_cache, file);
       return NULL; 
     }
 }
@@ -49,7 +74,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (&file_cache, file);
     }
 }
 
@@ -60,6 +85,36 @@ file_get_inode (struct file *file)
   return file->inode;
 }
 
+/* Notes that SIZE bytes are about to be read from FILE starting
+   at offset OFS.  If the read is sequential, starts reading
+   ahead the data that follows it. */
+static void
+read_ahead (struct file *file, off_t size, off_t ofs) 
+{
+  off_t start, end;
+
+  if (ofs != file->next_ofs) 
+    {
+      file->next_ofs = ofs + size;
+      file->ahead_ofs = file->window = 0;
+      return;
+    }
+
+  file->next_ofs = ofs + size;
+  if (file->window == 0)
+    file->window = READ_AHEAD_MIN;
+  else if (file->window < READ_AHEAD_MAX)
+    file->window *= 2;
+
+  start = file->ahead_ofs > ofs + size ? file->ahead_ofs : ofs + size;
+  end = ofs + size + file->window;
+  if (start < end) 
+    {
+      inode_read_ahead (file->inode, end - start, start);
+      file->ahead_ofs = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
@@ -68,7 +123,10 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  read_ahead (file, size, file->pos);
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +139,15 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
+  read_ahead (file, size, file_ofs);
   return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Grows the file if the write extends past end of file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +160,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Grows the file if the write extends past end of file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
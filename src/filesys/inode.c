@@ -2,32 +2,477 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Statistics, for comparing the inode layouts.  Like the block
+   device statistics, they are not synchronized, so they are only
+   approximate when several files grow at once. */
+static long long data_cnt;      /* Data sectors allocated. */
+static long long run_cnt;       /* Physically contiguous runs of them. */
+static long long meta_cnt;      /* Index or extent blocks allocated. */
+static long long meta_read_cnt; /* Reads from them to find data. */
+
+/* Each layout below defines `struct inode_disk', which must be
+   exactly BLOCK_SECTOR_SIZE bytes long and have `length' and
+   `magic' members, and these functions on it:
+
+     lookup_sector(DISK, IDX) returns the data sector that holds
+     sector IDX of the file, or 0 if it has none.
+
+     allocate_data_sector(DISK, IDX, EXTRA) makes sure the file
+     has a data sector for IDX, zeroed if it is new, and returns
+     it, or 0 if the disk is full or the file can grow no
+     larger.  The layout may preallocate up
+     to EXTRA more sectors past it.  The caller must write DISK
+     back to disk afterward.
+
+     trim_sectors(DISK) frees preallocated sectors that no data
+     has been written to, returning true if it changed DISK.
+
+     release_sectors(DISK) frees all of the file's sectors. */
+
+#ifdef INODE_INDEXED
+#define LAYOUT_NAME "indexed"
+
+/* Index layout.
+
+   An inode locates its data through a multilevel index.  The
+   first DIRECT_CNT sector numbers in the inode point directly to
+   data sectors.  The next one points to an "indirect" block of
+   PTRS_PER_SECTOR sector numbers of data sectors, and the last
+   one to a "doubly indirect" block of sector numbers of indirect
+   blocks.  That covers 124 + 128 + 128 * 128 sectors, a little
+   over 8 MB, enough for a file as large as the file system.
+
+   A sector number of 0 in the index, which cannot be a data
+   sector since the free map's inode lives there, is a "hole":
+   no sector has been allocated yet, and its data reads as
+   zeros.  A write into a hole, or past end of file, allocates
+   the sectors it needs, one at a time, so files grow on demand,
+   and writing far past end of file makes a sparse file. */
+
+/* Sector numbers in an index block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Sector numbers in an inode: direct, indirect, doubly indirect. */
+#define DIRECT_CNT 124
+#define INDIRECT_IDX DIRECT_CNT
+#define DBL_INDIRECT_IDX (DIRECT_CNT + 1)
+#define INDEX_CNT (DIRECT_CNT + 2)
+
+/* On-disk inode.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct inode_disk
+  {
+    block_sector_t sectors[INDEX_CNT];  /* Index; see above. */
+    off_t length;                       /* File size in bytes. */
+    unsigned magic;                     /* Magic number. */
+  };
+
+/* Allocates a sector, fills it with zeros, and returns it.
+   Returns 0 if the disk is full. */
+static block_sector_t
+allocate_sector (void) 
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector;
+
+  if (!free_map_allocate (1, &sector))
+    return 0;
+  cache_write (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+  return sector;
+}
+
+/* Returns the sector number in *ENTRY, an index entry held in
+   memory.  If it is 0 and ALLOC_CNT is nonnull, first allocates
+   a sector, stores it in *ENTRY, and counts it in *ALLOC_CNT.
+   Returns 0 for a hole, or if allocation fails. */
+static block_sector_t
+get_entry (block_sector_t *entry, long long *alloc_cnt) 
+{
+  if (*entry == 0 && alloc_cnt != NULL) 
+    {
+      *entry = allocate_sector ();
+      if (*entry != 0)
+        ++*alloc_cnt;
+    }
+  return *entry;
+}
+
+/* Returns the sector number in entry IDX of index block BLOCK,
+   allocating a sector for it if it is 0 and ALLOC_CNT is
+   nonnull, like get_entry(). */
+static block_sector_t
+get_block_entry (block_sector_t block, size_t idx, long long *alloc_cnt) 
+{
+  block_sector_t entry;
+
+  cache_read (block, &entry, idx * sizeof entry, sizeof entry);
+  meta_read_cnt++;
+  if (entry == 0 && alloc_cnt != NULL) 
+    {
+      entry = allocate_sector ();
+      if (entry != 0) 
+        {
+          cache_write (block, &entry, idx * sizeof entry, sizeof entry);
+          ++*alloc_cnt;
+        }
+    }
+  return entry;
+}
+
+/* Returns the data sector that holds sector IDX of the file that
+   DISK describes, or 0 if IDX is in a hole or beyond the largest
+   possible file.  If CREATE is true, allocates the data sector,
+   and any index blocks needed to reach it, for a hole, returning
+   0 only if the disk is full. */
+static block_sector_t
+index_lookup (struct inode_disk *disk, size_t idx, bool create) 
+{
+  long long *data = create ? &data_cnt : NULL;
+  long long *meta = create ? &meta_cnt : NULL;
+  block_sector_t block;
+
+  if (idx < DIRECT_CNT)
+    return get_entry (&disk->sectors[idx], data);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR) 
+    {
+      block = get_entry (&disk->sectors[INDIRECT_IDX], meta);
+      return block != 0 ? get_block_entry (block, idx, data) : 0;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR) 
+    {
+      block = get_entry (&disk->sectors[DBL_INDIRECT_IDX], meta);
+      if (block != 0)
+        block = get_block_entry (block, idx / PTRS_PER_SECTOR, meta);
+      return (block != 0
+              ? get_block_entry (block, idx % PTRS_PER_SECTOR, data)
+              : 0);
+    }
+
+  return 0;
+}
+
+static block_sector_t
+lookup_sector (struct inode_disk *disk, size_t idx) 
+{
+  return index_lookup (disk, idx, false);
+}
+
+/* The index layout allocates one sector at a time, so it ignores
+   EXTRA. */
+static block_sector_t
+allocate_data_sector (struct inode_disk *disk, size_t idx,
+                      size_t extra UNUSED) 
+{
+  block_sector_t sector = index_lookup (disk, idx, false);
+
+  if (sector == 0) 
+    {
+      sector = index_lookup (disk, idx, true);
+      if (sector != 0
+          && (idx == 0 || sector != index_lookup (disk, idx - 1, false) + 1))
+        run_cnt++;
+    }
+  return sector;
+}
+
+/* The index layout never preallocates. */
+static bool
+trim_sectors (struct inode_disk *disk UNUSED) 
+{
+  return false;
+}
+
+/* Frees SECTOR, unless it is 0.  If LEVEL is greater than 0,
+   SECTOR is an index block, and the blocks its entries point to,
+   at LEVEL - 1, are freed first. */
+static void
+free_tree (block_sector_t sector, int level) 
+{
+  if (sector == 0)
+    return;
+  if (level > 0) 
+    {
+      size_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        free_tree (get_block_entry (sector, i, NULL), level - 1);
+    }
+  free_map_release (sector, 1);
+}
+
+static void
+release_sectors (struct inode_disk *disk) 
+{
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    free_tree (disk->sectors[i], 0);
+  free_tree (disk->sectors[INDIRECT_IDX], 1);
+  free_tree (disk->sectors[DBL_INDIRECT_IDX], 2);
+}
+#else /* !INODE_INDEXED */
+#define LAYOUT_NAME "extent"
+
+/* Extent layout.
+
+   An inode maps its data as a list of extents, each a run of
+   physically contiguous sectors, in file order: the first extent
+   holds the file's first sectors, the next one the sectors after
+   those, and so on.  The first INLINE_EXTENTS extents are kept in
+   the inode itself, the rest in a single overflow extent block.
+   Finding the sector for an offset walks the list, so it takes
+   O(extents) time, and since a file written sequentially needs
+   only a few extents, finding it normally reads no sector but the
+   inode, and index blocks do not take up room in the buffer
+   cache.
+
+   A file grows by extending its last extent in place, through
+   free_map_extend(), when the sectors after it are free, and
+   otherwise by adding an extent.  Either way it preallocates
+   more sectors than it needs, as many as its caller suggests, so
+   that files that grow at the same time do not interleave sector
+   by sector.  The sectors from `sector_cnt' to `alloc_cnt' are
+   preallocated: they hold no data, not even zeros, and they are
+   freed when the file is last closed.
+
+   A file has no holes: a write past end of file zeros the
+   sectors between. */
+
+/* A run of physically contiguous sectors. */
+struct extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t cnt;                       /* Number of sectors. */
+  };
+
+/* Extents in an inode, in an overflow extent block, in all. */
+#define INLINE_EXTENTS 61
+#define EXTENTS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+#define MAX_EXTENTS (INLINE_EXTENTS + EXTENTS_PER_SECTOR)
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t sector_cnt;                /* Sectors in use. */
+    uint32_t alloc_cnt;                 /* Sectors in extents. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    block_sector_t overflow;            /* Overflow extent block, or 0. */
+    struct extent extents[INLINE_EXTENTS]; /* First extents. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
+/* Copies extent I of the file that DISK describes into *E. */
+static void
+get_extent (const struct inode_disk *disk, size_t i, struct extent *e) 
+{
+  if (i < INLINE_EXTENTS)
+    *e = disk->extents[i];
+  else 
+    {
+      cache_read (disk->overflow, e, (i - INLINE_EXTENTS) * sizeof *e,
+                  sizeof *e);
+      meta_read_cnt++;
+    }
+}
+
+/* Sets extent I of the file that DISK describes to *E. */
+static void
+put_extent (struct inode_disk *disk, size_t i, const struct extent *e) 
+{
+  if (i < INLINE_EXTENTS)
+    disk->extents[i] = *e;
+  else
+    cache_write (disk->overflow, e, (i - INLINE_EXTENTS) * sizeof *e,
+                 sizeof *e);
+}
+
+/* Returns the sector that the extents of DISK map sector IDX of
+   the file to.  IDX must be less than DISK's `alloc_cnt'. */
+static block_sector_t
+find_sector (const struct inode_disk *disk, size_t idx) 
+{
+  size_t i;
+
+  for (i = 0; i < disk->extent_cnt; i++) 
+    {
+      struct extent e;
+
+      get_extent (disk, i, &e);
+      if (idx < e.cnt)
+        return e.start + idx;
+      idx -= e.cnt;
+    }
+  NOT_REACHED ();
+}
+
+static block_sector_t
+lookup_sector (struct inode_disk *disk, size_t idx) 
 {
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+  return idx < disk->sector_cnt ? find_sector (disk, idx) : 0;
 }
 
+/* Adds at least CNT sectors to the extents of DISK, and up to
+   CNT + EXTRA if they can be had in one run.  Returns false if
+   the disk is full or the file has as many extents as it can,
+   in which case DISK may have gained fewer than CNT sectors. */
+static bool
+add_sectors (struct inode_disk *disk, size_t cnt, size_t extra) 
+{
+  size_t want = cnt + extra;
+
+  while (cnt > 0) 
+    {
+      struct extent e;
+      size_t got = 0;
+
+      /* Extend the last extent in place, if the sectors after it
+         are free. */
+      if (disk->extent_cnt > 0) 
+        {
+          get_extent (disk, disk->extent_cnt - 1, &e);
+          got = free_map_extend (e.start + e.cnt, want);
+          if (got > 0) 
+            {
+              e.cnt += got;
+              put_extent (disk, disk->extent_cnt - 1, &e);
+            }
+        }
+
+      /* Otherwise, add an extent, as long as the free map has a
+         run of sectors for it. */
+      if (got == 0) 
+        {
+          if (disk->extent_cnt >= MAX_EXTENTS)
+            return false;
+          if (disk->extent_cnt == INLINE_EXTENTS && disk->overflow == 0) 
+            {
+              if (!free_map_allocate (1, &disk->overflow))
+                return false;
+              meta_cnt++;
+            }
+          for (got = want; !free_map_allocate (got, &e.start); got /= 2)
+            if (got == 1)
+              return false;
+          e.cnt = got;
+          put_extent (disk, disk->extent_cnt, &e);
+          disk->extent_cnt++;
+          run_cnt++;
+        }
+
+      disk->alloc_cnt += got;
+      data_cnt += got;
+      cnt = got < cnt ? cnt - got : 0;
+      want -= got < want ? got : want;
+    }
+  return true;
+}
+
+static block_sector_t
+allocate_data_sector (struct inode_disk *disk, size_t idx, size_t extra) 
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (idx < disk->sector_cnt)
+    return find_sector (disk, idx);
+
+  if (idx >= disk->alloc_cnt
+      && !add_sectors (disk, idx + 1 - disk->alloc_cnt, extra))
+    return 0;
+
+  /* Sectors between the old end of the file and IDX become part
+     of the file, so zero them, along with IDX itself. */
+  for (; disk->sector_cnt <= idx; disk->sector_cnt++)
+    cache_write (find_sector (disk, disk->sector_cnt), zeros,
+                 0, BLOCK_SECTOR_SIZE);
+  return find_sector (disk, idx);
+}
+
+static bool
+trim_sectors (struct inode_disk *disk) 
+{
+  size_t left = disk->sector_cnt;
+  size_t extent_cnt = 0;
+  size_t i;
+
+  if (disk->alloc_cnt == disk->sector_cnt)
+    return false;
+
+  for (i = 0; i < disk->extent_cnt; i++) 
+    {
+      struct extent e;
+
+      get_extent (disk, i, &e);
+      if (left >= e.cnt) 
+        {
+          left -= e.cnt;
+          extent_cnt = i + 1;
+          continue;
+        }
+
+      /* Free the part of extent I past the data, and the whole of
+         every later extent.  Preallocated sectors should not
+         count as allocated, so give them back in the statistics,
+         too. */
+      free_map_release (e.start + left, e.cnt - left);
+      data_cnt -= e.cnt - left;
+      if (left > 0) 
+        {
+          e.cnt = left;
+          put_extent (disk, i, &e);
+          extent_cnt = i + 1;
+          left = 0;
+        }
+      else
+        run_cnt--;
+    }
+  disk->extent_cnt = extent_cnt;
+  disk->alloc_cnt = disk->sector_cnt;
+
+  if (extent_cnt <= INLINE_EXTENTS && disk->overflow != 0) 
+    {
+      free_map_release (disk->overflow, 1);
+      disk->overflow = 0;
+      meta_cnt--;
+    }
+  return true;
+}
+
+static void
+release_sectors (struct inode_disk *disk) 
+{
+  size_t i;
+
+  for (i = 0; i < disk->extent_cnt; i++) 
+    {
+      struct extent e;
+
+      get_extent (disk, i, &e);
+      free_map_release (e.start, e.cnt);
+    }
+  if (disk->overflow != 0)
+    free_map_release (disk->overflow, 1);
+}
+#endif /* !INODE_INDEXED */
+
 /* In-memory inode. */
 struct inode 
   {
@@ -36,37 +481,77 @@ struct inode
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rwlock;               /* See inode_lock_shared(). */
+    struct lock grow_lock;              /* Serializes changes to DATA. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* Sectors that a write past end of file preallocates past the
+   sector it needs, for layouts that preallocate: about as many as
+   the file already has, so that a file takes longer runs as it
+   grows, within these bounds. */
+#define PREALLOC_MIN 8
+#define PREALLOC_MAX 128
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, or 0 if POS is in a hole.  If CREATE is true,
+   allocates a sector for a hole, returning 0 only if the disk is
+   full or the file has grown as large as the layout allows. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool create) 
 {
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t sector;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+
+  sector = lookup_sector (&inode->data, idx);
+  if (sector == 0 && create) 
+    {
+      size_t extra = idx;
+      if (extra < PREALLOC_MIN)
+        extra = PREALLOC_MIN;
+      else if (extra > PREALLOC_MAX)
+        extra = PREALLOC_MAX;
+
+      lock_acquire (&inode->grow_lock);
+      sector = allocate_data_sector (&inode->data, idx, extra);
+      cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+      lock_release (&inode->grow_lock);
+    }
+  return sector;
 }
 
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Protects open_inodes.  Opening an inode that is already open,
+   by far the common case, only reads the list, so it is guarded
+   by a readers-writer lock to let such opens run concurrently.
+   An inode's open_cnt may be incremented by concurrent readers,
+   so it is only modified with interrupts off. */
+static struct rwlock open_inodes_lock;
+
+/* Cache of `struct inode's. */
+static struct kmem_cache inode_cache;
+
+static struct inode *find_open_inode (block_sector_t);
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  rwlock_init (&open_inodes_lock, false);
+  kmem_cache_init (&inode_cache, "inode", sizeof (struct inode), NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data sectors are allocated, and zeroed, up front,
+   so that writes within LENGTH never need to allocate; the free
+   map file depends on that.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -84,22 +569,24 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
+      size_t sectors = DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE);
+      size_t i;
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+
+      /* Offering the rest of the file as preallocation lets a
+         layout that allocates runs take it all at once. */
+      for (i = 0; i < sectors; i++)
+        if (allocate_data_sector (disk_inode, i, sectors - i - 1) == 0)
+          break;
+      if (i >= sectors) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          cache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
           success = true; 
         } 
+      else
+        release_sectors (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,25 +598,26 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
+  rwlock_acquire_read (&open_inodes_lock);
+  inode = inode_reopen (find_open_inode (sector));
+  rwlock_release_read (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
+
+  /* Check again, since another thread may have opened it while
+     we did not hold the lock. */
+  rwlock_acquire_write (&open_inodes_lock);
+  inode = inode_reopen (find_open_inode (sector));
+  if (inode != NULL)
+    goto done;
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (&inode_cache);
   if (inode == NULL)
-    return NULL;
+    goto done;
 
   /* Initialize. */
   list_push_front (&open_inodes, &inode->elem);
@@ -137,16 +625,42 @@ inode_open (block_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  rwlock_init (&inode->rwlock, true);
+  lock_init (&inode->grow_lock);
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
+ done:
+  rwlock_release_write (&open_inodes_lock);
   return inode;
 }
 
+/* Returns the open inode for SECTOR, or a null pointer if there
+   is none.  The caller must hold open_inodes_lock. */
+static struct inode *
+find_open_inode (block_sector_t sector) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+       e = list_next (e)) 
+    {
+      struct inode *inode = list_entry (e, struct inode, elem);
+      if (inode->sector == sector) 
+        return inode;
+    }
+  return NULL;
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      enum intr_level old_level = intr_disable ();
+      inode->open_cnt++;
+      intr_set_level (old_level);
+    }
   return inode;
 }
 
@@ -163,26 +677,54 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  enum intr_level old_level;
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Closing a reference other than the last one only needs to
+     drop the count. */
+  old_level = intr_disable ();
+  last = inode->open_cnt == 1;
+  if (!last)
+    inode->open_cnt--;
+  intr_set_level (old_level);
+  if (!last)
+    return;
+
+  /* Release resources if this was the last opener.  Holding
+     open_inodes_lock for writing keeps inode_open() from finding
+     INODE between the last close and its removal from the list. */
+  rwlock_acquire_write (&open_inodes_lock);
+  old_level = intr_disable ();
+  last = --inode->open_cnt == 0;
+  intr_set_level (old_level);
+  if (last)
     {
+      /* Give back preallocated blocks before the inode leaves the
+         list, so that a concurrent inode_open() of this sector
+         waits for the trimmed inode to reach the cache instead of
+         reading the old one, whose extents still cover them. */
+      if (!inode->removed && trim_sectors (&inode->data))
+        cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
       /* Remove from inode list and release lock. */
       list_remove (&inode->elem);
+      rwlock_release_write (&open_inodes_lock);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          release_sectors (&inode->data);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
         }
 
-      free (inode); 
+      kmem_cache_free (&inode_cache, inode);
     }
+  else
+    rwlock_release_write (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -196,18 +738,18 @@ inode_remove (struct inode *inode)
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Holes read as zeros. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,47 +762,50 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx != 0)
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+/* Starts reading the SIZE bytes of INODE that begin at OFFSET
+   into the buffer cache in the background, in the expectation
+   that they will be read soon. */
+void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset) 
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE) 
+    {
+      block_sector_t sector = byte_to_sector (inode, offset, false);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   extending INODE if the write ends past end of file.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full or the file would exceed
+   the largest possible size. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
@@ -268,51 +813,35 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, true);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      cache_write (sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file only after writing its new data, so that
+     readers never see the new length before the data. */
+  if (offset > inode->data.length) 
+    {
+      lock_acquire (&inode->grow_lock);
+      if (offset > inode->data.length) 
+        {
+          inode->data.length = offset;
+          cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+        }
+      lock_release (&inode->grow_lock);
+    }
 
   return bytes_written;
 }
@@ -343,3 +872,43 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Acquires INODE's readers-writer lock for reading.  Directory
+   code holds it this way while searching a directory, so that
+   lookups in the same directory proceed concurrently. */
+void
+inode_lock_shared (struct inode *inode) 
+{
+  rwlock_acquire_read (&inode->rwlock);
+}
+
+/* Releases INODE's lock, held for reading. */
+void
+inode_unlock_shared (struct inode *inode) 
+{
+  rwlock_release_read (&inode->rwlock);
+}
+
+/* Acquires INODE's readers-writer lock for writing, e.g. to add
+   or remove a directory entry. */
+void
+inode_lock_exclusive (struct inode *inode) 
+{
+  rwlock_acquire_write (&inode->rwlock);
+}
+
+/* Releases INODE's lock, held for writing. */
+void
+inode_unlock_exclusive (struct inode *inode) 
+{
+  rwlock_release_write (&inode->rwlock);
+}
+
+/* Prints statistics about the inode layout. */
+void
+inode_print_stats (void) 
+{
+  printf ("Inodes (%s layout): %lld data sectors in %lld runs, "
+          "%lld metadata sectors, %lld metadata reads\n",
+          LAYOUT_NAME, data_cnt, run_cnt, meta_cnt, meta_read_cnt);
+}
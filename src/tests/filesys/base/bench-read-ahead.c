@@ -0,0 +1,34 @@
+/* Measures read-ahead on sequential reads: writes a 200,000-byte
+   file, far larger than the buffer cache, one 513-byte block at
+   a time like lg-seq-block, reads it back the same way, and then
+   executes a child process, whose loader reads its executable
+   sequentially too.
+
+   At shutdown the kernel prints a "Buffer cache" line with the
+   number of cache hits and misses and of sectors read ahead.
+   Sequential reads that read-ahead keeps ahead of show up as
+   hits on sectors that were read ahead, instead of as misses,
+   each of which stalls the reader on one sector's disk read. */
+
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TEST_SIZE 200000
+static char buf[TEST_SIZE];
+
+static size_t
+return_block_size (void) 
+{
+  return 513;
+}
+
+void
+test_main (void) 
+{
+  seq_test ("noodle",
+            buf, sizeof buf, sizeof buf,
+            return_block_size, NULL);
+  wait (exec ("child-simple"));
+}
@@ -0,0 +1,31 @@
+# -*- perl -*-
+
+# Besides the usual test output, expects the buffer cache
+# statistics, with counts depending on the machine, e.g.:
+#
+# Buffer cache: 1500 hits, 420 misses, 380 read ahead, 400 writebacks in 60 requests
+
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "No buffer cache statistics found.\n"
+  if !grep (/^Buffer cache: \d+ hits, \d+ misses, \d+ read ahead, /,
+            @output);
+
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(bench-read-ahead) begin
+(bench-read-ahead) create "noodle"
+(bench-read-ahead) open "noodle"
+(bench-read-ahead) writing "noodle"
+(bench-read-ahead) close "noodle"
+(bench-read-ahead) open "noodle" for verification
+(bench-read-ahead) verified contents of "noodle"
+(bench-read-ahead) close "noodle"
+(child-simple) run
+child-simple: exit(81)
+(bench-read-ahead) end
+EOF
+pass;
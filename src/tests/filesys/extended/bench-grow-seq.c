@@ -0,0 +1,15 @@
+/* Measures how the inode layout places a file that grows
+   sequentially: grows a file from 0 bytes to 200,000 bytes,
+   1,234 bytes at a time, like grow-seq-lg but large enough to
+   need an indirect block in the indexed layout, and reads it
+   back.
+
+   At shutdown the kernel prints an "Inodes" line with the number
+   of data sectors allocated, the number of physically contiguous
+   runs they form, and the number of index or extent blocks
+   allocated and read to find data.  Comparing that line between
+   kernels built with and without -DINODE_INDEXED compares the
+   indexed and extent layouts. */
+
+#define TEST_SIZE 200000
+#include "tests/filesys/extended/grow-seq.inc"
@@ -0,0 +1,30 @@
+# -*- perl -*-
+
+# Besides the usual test output, expects the inode statistics,
+# with the counts depending on the inode layout, e.g.:
+#
+# Inodes (extent layout): 391 data sectors in 2 runs, 0 metadata sectors, 0 metadata reads
+
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "No inode statistics found.\n"
+  if !grep (/^Inodes \(\w+ layout\): \d+ data sectors in \d+ runs, /,
+            @output);
+
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(bench-grow-seq) begin
+(bench-grow-seq) create "testme"
+(bench-grow-seq) open "testme"
+(bench-grow-seq) writing "testme"
+(bench-grow-seq) close "testme"
+(bench-grow-seq) open "testme" for verification
+(bench-grow-seq) verified contents of "testme"
+(bench-grow-seq) close "testme"
+(bench-grow-seq) end
+EOF
+pass;
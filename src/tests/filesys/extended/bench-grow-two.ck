@@ -0,0 +1,34 @@
+# -*- perl -*-
+
+# Besides the usual test output, expects the inode statistics,
+# as described in bench-grow-seq.ck.
+
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "No inode statistics found.\n"
+  if !grep (/^Inodes \(\w+ layout\): \d+ data sectors in \d+ runs, /,
+            @output);
+
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(bench-grow-two) begin
+(bench-grow-two) create "a"
+(bench-grow-two) create "b"
+(bench-grow-two) open "a"
+(bench-grow-two) open "b"
+(bench-grow-two) write "a" and "b" alternately
+(bench-grow-two) close "a"
+(bench-grow-two) close "b"
+(bench-grow-two) open "a" for verification
+(bench-grow-two) verified contents of "a"
+(bench-grow-two) close "a"
+(bench-grow-two) open "b" for verification
+(bench-grow-two) verified contents of "b"
+(bench-grow-two) close "b"
+(bench-grow-two) end
+EOF
+pass;
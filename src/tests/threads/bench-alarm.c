@@ -0,0 +1,59 @@
+/* Puts 1,000 threads to sleep with random deadlines and reports
+   how long the timer interrupt handler takes while they wake up.
+
+   Each sleeper runs at a priority above the main thread's, so
+   that it goes to sleep as soon as it is created.  Once all of
+   them are asleep, the main thread resets the timer's interrupt
+   statistics and waits for every sleeper to wake up. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <random.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define THREAD_CNT 1000
+#define MAX_SLEEP 200
+
+static thread_func sleeper;
+static struct semaphore wake_sema;
+
+void
+test_bench_alarm (void) 
+{
+  struct timer_irq_stats stats;
+  int i;
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  sema_init (&wake_sema, 0);
+  msg ("Putting %d threads to sleep for up to %d ticks each.",
+       THREAD_CNT, MAX_SLEEP);
+  for (i = 0; i < THREAD_CNT; i++)
+    if (thread_create ("sleeper", PRI_DEFAULT + 1,
+                       sleeper, NULL) == TID_ERROR)
+      fail ("could not create thread %d of %d", i, THREAD_CNT);
+
+  timer_reset_irq_stats ();
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&wake_sema);
+  timer_get_irq_stats (&stats);
+
+  msg ("All %d threads woke up.", THREAD_CNT);
+  msg ("%"PRId64" interrupts, %"PRId64" wakeups: "
+       "%"PRIu64" cycles per interrupt on average, %"PRIu64" at most.",
+       stats.interrupts, stats.wakeups,
+       stats.total_cycles / (stats.interrupts > 0 ? stats.interrupts : 1),
+       stats.max_cycles);
+}
+
+static void
+sleeper (void *aux UNUSED) 
+{
+  timer_sleep (1 + random_ulong () % MAX_SLEEP);
+  sema_up (&wake_sema);
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+
+# The expected output looks like this, with the interrupt counts
+# and cycle counts depending on the machine and random deadlines:
+#
+# (bench-alarm) Putting 1000 threads to sleep for up to 200 ticks each.
+# (bench-alarm) All 1000 threads woke up.
+# (bench-alarm) 200 interrupts, 1000 wakeups: 2400 cycles per interrupt on average, 31000 at most.
+
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+fail "Not all threads woke up.\n"
+  if !grep (/All 1000 threads woke up\./, @output);
+fail "No tick handler measurement found.\n"
+  if !grep (/\d+ interrupts, 1000 wakeups: \d+ cycles per interrupt/,
+	    @output);
+pass;
@@ -0,0 +1,80 @@
+/* Measures the cost of waking the highest-priority waiter out of
+   a convoy of 100 and 500 threads blocked on one semaphore.
+
+   The main thread creates the waiters at priorities above its
+   own, spread over the whole range, so that each of them blocks
+   on the semaphore as soon as it is created.  The main thread
+   then ups the semaphore once per waiter.  Each up wakes the
+   highest-priority waiter out of all those still queued, which
+   preempts the main thread, signals completion, and exits, so
+   the elapsed time-stamp counter divided by the number of
+   waiters approximates the cost of one contended handoff. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/cycles.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+struct convoy 
+  {
+    struct semaphore sema;      /* The contended semaphore. */
+    struct semaphore done;      /* Upped by each waiter when done. */
+  };
+
+static thread_func waiter_thread;
+static void measure_convoy (int waiter_cnt);
+
+void
+test_bench_convoy (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  measure_convoy (100);
+  measure_convoy (500);
+}
+
+static void
+measure_convoy (int waiter_cnt) 
+{
+  struct convoy convoy;
+  uint64_t start, cycles;
+  int i;
+
+  sema_init (&convoy.sema, 0);
+  sema_init (&convoy.done, 0);
+
+  for (i = 0; i < waiter_cnt; i++)
+    {
+      int priority = PRI_DEFAULT + 1 + i % (PRI_MAX - PRI_DEFAULT);
+      if (thread_create ("waiter", priority,
+                         waiter_thread, &convoy) == TID_ERROR)
+        fail ("could not create thread %d of %d", i, waiter_cnt);
+    }
+
+  start = rdtsc ();
+  for (i = 0; i < waiter_cnt; i++)
+    sema_up (&convoy.sema);
+  cycles = rdtsc () - start;
+
+  for (i = 0; i < waiter_cnt; i++)
+    sema_down (&convoy.done);
+
+  msg ("%d waiters: %"PRIu64" cycles per handoff.",
+       waiter_cnt, cycles / waiter_cnt);
+}
+
+static void
+waiter_thread (void *convoy_) 
+{
+  struct convoy *convoy = convoy_;
+
+  sema_down (&convoy->sema);
+  sema_up (&convoy->done);
+}
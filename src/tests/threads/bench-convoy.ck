@@ -0,0 +1,22 @@
+# -*- perl -*-
+
+# The expected output looks like this, with the cycle counts
+# depending on the machine:
+#
+# (bench-convoy) 100 waiters: 2100 cycles per handoff.
+# (bench-convoy) 500 waiters: 2300 cycles per handoff.
+
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+foreach my $cnt (100, 500) {
+    fail "No measurement found for $cnt waiters.\n"
+      if !grep (/ $cnt waiters: \d+ cycles per handoff\./, @output);
+}
+pass;
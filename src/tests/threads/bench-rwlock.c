@@ -0,0 +1,120 @@
+/* Compares the throughput of a read-mostly workload protected by
+   a plain lock with the same workload protected by a
+   readers-writer lock.
+
+   Each of THREAD_CNT threads performs OP_CNT operations on a
+   shared array.  One operation in WRITE_PERIOD is a write, which
+   increments every element of the array; the rest are reads,
+   which check that every element has the same value.  Each
+   operation yields the CPU halfway through, as a real critical
+   section might while waiting for a disk, so that with the
+   readers-writer lock other readers can enter in the meantime.
+   The check catches any reader that overlaps a writer. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/cycles.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 8
+#define OP_CNT 500
+#define WRITE_PERIOD 16
+#define DATA_CNT 64
+
+struct shared 
+  {
+    bool use_rwlock;            /* Use `rwlock' instead of `lock'? */
+    struct lock lock;
+    struct rwlock rwlock;
+    int data[DATA_CNT];         /* All elements always equal. */
+    struct semaphore done;      /* Upped by each thread when done. */
+  };
+
+static thread_func worker_thread;
+static void measure (bool use_rwlock);
+
+void
+test_bench_rwlock (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  measure (false);
+  measure (true);
+}
+
+static void
+measure (bool use_rwlock) 
+{
+  static struct shared shared;
+  uint64_t start, cycles;
+  int i;
+
+  shared.use_rwlock = use_rwlock;
+  lock_init (&shared.lock);
+  rwlock_init (&shared.rwlock, true);
+  for (i = 0; i < DATA_CNT; i++)
+    shared.data[i] = 0;
+  sema_init (&shared.done, 0);
+
+  start = rdtsc ();
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "worker %d", i);
+      thread_create (name, PRI_DEFAULT, worker_thread, &shared);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_down (&shared.done);
+  cycles = rdtsc () - start;
+
+  if (shared.data[0] != THREAD_CNT * (OP_CNT / WRITE_PERIOD))
+    fail ("%d writes were lost",
+          THREAD_CNT * (OP_CNT / WRITE_PERIOD) - shared.data[0]);
+
+  msg ("%s: %"PRIu64" cycles per operation.",
+       use_rwlock ? "rwlock" : "lock", cycles / (THREAD_CNT * OP_CNT));
+}
+
+static void
+worker_thread (void *shared_) 
+{
+  struct shared *shared = shared_;
+  int op, i;
+
+  for (op = 0; op < OP_CNT; op++) 
+    {
+      bool write = op % WRITE_PERIOD == WRITE_PERIOD - 1;
+
+      if (!shared->use_rwlock)
+        lock_acquire (&shared->lock);
+      else if (write)
+        rwlock_acquire_write (&shared->rwlock);
+      else
+        rwlock_acquire_read (&shared->rwlock);
+
+      for (i = 0; i < DATA_CNT; i++) 
+        {
+          if (i == DATA_CNT / 2)
+            thread_yield ();
+          if (write)
+            shared->data[i]++;
+          else if (shared->data[i] != shared->data[0])
+            fail ("reader saw a write in progress");
+        }
+
+      if (!shared->use_rwlock)
+        lock_release (&shared->lock);
+      else if (write)
+        rwlock_release_write (&shared->rwlock);
+      else
+        rwlock_release_read (&shared->rwlock);
+    }
+  sema_up (&shared->done);
+}
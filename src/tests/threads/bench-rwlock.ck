@@ -0,0 +1,22 @@
+# -*- perl -*-
+
+# The expected output looks like this, with the cycle counts
+# depending on the machine:
+#
+# (bench-rwlock) lock: 9000 cycles per operation.
+# (bench-rwlock) rwlock: 3000 cycles per operation.
+
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+foreach my $kind ('lock', 'rwlock') {
+    fail "No measurement found for $kind.\n"
+      if !grep (/ $kind: \d+ cycles per operation\./, @output);
+}
+pass;
@@ -0,0 +1,65 @@
+/* Measures the cost of a context switch with 10, 100, and 1000
+   threads on the run queue.
+
+   The main thread creates THREAD_CNT threads at a priority just
+   below its own, so that none of them runs yet, then drops its
+   own priority to the minimum.  The new threads then take turns
+   yielding to one another YIELD_CNT times each before exiting,
+   and the main thread runs again only once all of them are gone.
+   The elapsed time-stamp counter, divided by the number of
+   switches, approximates the cycles spent per switch. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/cycles.h"
+#include "threads/init.h"
+#include "threads/thread.h"
+
+#define YIELD_CNT 16
+
+static thread_func yield_thread;
+static void measure_switches (int thread_cnt);
+
+void
+test_bench_switch (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  measure_switches (10);
+  measure_switches (100);
+  measure_switches (1000);
+}
+
+static void
+measure_switches (int thread_cnt) 
+{
+  uint64_t start, cycles;
+  int i;
+
+  for (i = 0; i < thread_cnt; i++)
+    if (thread_create ("yielder", PRI_DEFAULT - 1,
+                       yield_thread, NULL) == TID_ERROR)
+      fail ("could not create thread %d of %d", i, thread_cnt);
+
+  start = rdtsc ();
+  thread_set_priority (PRI_MIN);
+  cycles = rdtsc () - start;
+  thread_set_priority (PRI_DEFAULT);
+
+  msg ("%d threads: %"PRIu64" cycles per switch.",
+       thread_cnt, cycles / (thread_cnt * (YIELD_CNT + 1)));
+}
+
+static void
+yield_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < YIELD_CNT; i++)
+    thread_yield ();
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+
+# The expected output looks like this, with the cycle counts
+# depending on the machine:
+#
+# (bench-switch) 10 threads: 812 cycles per switch.
+# (bench-switch) 100 threads: 798 cycles per switch.
+# (bench-switch) 1000 threads: 805 cycles per switch.
+
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+foreach my $cnt (10, 100, 1000) {
+    fail "No measurement found for $cnt threads.\n"
+      if !grep (/ $cnt threads: \d+ cycles per switch\./, @output);
+}
+pass;
@@ -0,0 +1,18 @@
+#ifndef THREADS_CYCLES_H
+#define THREADS_CYCLES_H
+
+#include <stdint.h>
+
+/* Returns the processor's time-stamp counter, which counts clock
+   cycles since the CPU was reset.  Useful for measuring short
+   intervals that are far below the resolution of the timer.
+   See [IA32-v2b] "RDTSC". */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+#endif /* threads/cycles.h */
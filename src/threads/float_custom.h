@@ -1,23 +1,93 @@
-//I'll follow 17.14 format as in the document.
-
-#ifndef FLOAT_CUSTOM_H
-#define FLOAT_CUSTOM_H
-
-#include <debug.h>
-#include <stdint.h>
-
-#define int my_float;
-#define scale_f = 1<<14;
-
-my_float to_my_float(int);
-int to_int_rzero(my_float);
-int to_int_rnear(my_float);
-
-my_float add(my_float, my_float);
-my_float add_int(my_float, my_float);
-my_float sub(my_float, my_float);
-my_float sub_int(my_float, int);
-my_float mult(my_float, my_float);
-my_float mult_int(my_float, int);
-my_float div(my_float, my_float);
-my_float div_int(my_float, int);
\ No newline at end of file
+#ifndef THREADS_FLOAT_CUSTOM_H
+#define THREADS_FLOAT_CUSTOM_H
+
+#include <stdint.h>
+
+/* Signed fixed-point real numbers in 17.14 format, as used by
+   the 4.4BSD scheduler: the low 14 bits of an int hold the
+   fraction, the remaining 17 bits the integer part and sign.
+   The largest representable value is about 131,071.999. */
+typedef int my_float;
+
+/* Number of fraction bits, and the value 1.0. */
+#define FLOAT_SHIFT 14
+#define scale_f (1 << FLOAT_SHIFT)
+
+/* Converts integer N to fixed point. */
+static inline my_float
+to_my_float (int n)
+{
+  return n * scale_f;
+}
+
+/* Converts X to an integer, rounding toward zero. */
+static inline int
+to_int_rzero (my_float x)
+{
+  return x / scale_f;
+}
+
+/* Converts X to an integer, rounding to nearest. */
+static inline int
+to_int_rnear (my_float x)
+{
+  return x >= 0 ? (x + scale_f / 2) / scale_f : (x - scale_f / 2) / scale_f;
+}
+
+/* Returns X + Y. */
+static inline my_float
+add (my_float x, my_float y)
+{
+  return x + y;
+}
+
+/* Returns X + N, for integer N. */
+static inline my_float
+add_int (my_float x, int n)
+{
+  return x + n * scale_f;
+}
+
+/* Returns X - Y. */
+static inline my_float
+sub (my_float x, my_float y)
+{
+  return x - y;
+}
+
+/* Returns X - N, for integer N. */
+static inline my_float
+sub_int (my_float x, int n)
+{
+  return x - n * scale_f;
+}
+
+/* Returns X * Y.  The intermediate product needs 64 bits. */
+static inline my_float
+mult (my_float x, my_float y)
+{
+  return ((int64_t) x) * y / scale_f;
+}
+
+/* Returns X * N, for integer N. */
+static inline my_float
+mult_int (my_float x, int n)
+{
+  return x * n;
+}
+
+/* Returns X / Y.  The scaled dividend needs 64 bits. */
+static inline my_float
+div (my_float x, my_float y)
+{
+  return ((int64_t) x) * scale_f / y;
+}
+
+/* Returns X / N, for integer N. */
+static inline my_float
+div_int (my_float x, int n)
+{
+  return x / n;
+}
+
+#endif /* threads/float_custom.h */
@@ -359,6 +359,14 @@ intr_handler (struct intr_frame *frame)
 
       in_external_intr = true;
       yield_on_return = false;
+
+      /* If this interrupt woke the idle thread, its handler may
+         make a thread ready and preempt the idle thread before
+         it gets to call timer_idle_exit(), so bring the timer up
+         to date first.  The timer's own interrupt does that
+         itself. */
+      if (frame->vec_no != 0x20)
+        timer_idle_exit ();
     }
 
   /* Invoke the interrupt's handler. */
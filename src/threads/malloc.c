@@ -1,86 +1,96 @@
 #include "threads/malloc.h"
 #include <debug.h>
-#include <list.h>
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
+#include "threads/memstat.h"
 #include "threads/palloc.h"
-#include "threads/synch.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
-
-   Otherwise, a new page of memory, called an "arena", is
-   obtained from the page allocator (if none is available,
-   malloc() returns a null pointer).  The new arena is divided
-   into blocks, all of which are added to the descriptor's free
-   list.  Then we return one of the new blocks.
-
-   When we free a block, we add it to its descriptor's free list.
-   But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
-
-/* Descriptor. */
-struct desc
+   The size of each request, in bytes, is rounded up to the
+   nearest of a fixed set of size classes and handed to the
+   object cache that manages blocks of that size (see slab.c).
+   Successive classes differ by a factor of at most 1.5, so
+   rounding up wastes less than a third of a block, instead of up
+   to half of it with power-of-2 sizes.
+
+   We can't handle blocks bigger than the largest class using
+   this scheme, because fewer than two of them fit in a slab.  We
+   handle those by allocating contiguous pages with the page
+   allocator and sticking the allocation size at the beginning of
+   the allocated block's page, in a header whose magic number
+   tells it apart from a slab. */
+
+/* Size classes.  The last one is the biggest multiple of 8 that
+   fits two to a slab. */
+static const size_t class_sizes[] =
   {
-    size_t block_size;          /* Size of each element in bytes. */
-    size_t blocks_per_arena;    /* Number of blocks in an arena. */
-    struct list free_list;      /* List of free blocks. */
-    struct lock lock;           /* Lock. */
+    16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1344, 2032,
   };
+#define CLASS_CNT (sizeof class_sizes / sizeof *class_sizes)
+#define CLASS_MAX 2032
 
-/* Magic number for detecting arena corruption. */
-#define ARENA_MAGIC 0x9a548eed
+/* Object cache for each size class. */
+static struct kmem_cache classes[CLASS_CNT];
 
-/* Arena. */
-struct arena 
+/* Maps a request of SIZE bytes, for 0 < SIZE <= CLASS_MAX, to the
+   index of its size class, via class_of[(SIZE + 7) / 8]. */
+static uint8_t class_of[CLASS_MAX / 8 + 1];
+
+/* Magic number for detecting big block corruption. */
+#define BIG_MAGIC 0x9a548eed
+
+/* Header of a big block. */
+struct big_block
   {
-    unsigned magic;             /* Always set to ARENA_MAGIC. */
-    struct desc *desc;          /* Owning descriptor, null for big block. */
-    size_t free_cnt;            /* Free blocks; pages in big block. */
+    unsigned magic;             /* Always set to BIG_MAGIC. */
+    size_t page_cnt;            /* Number of pages. */
   };
 
-/* Free block. */
-struct block 
+#ifdef MEMSTAT
+/* Usage of a size class. */
+struct class_stat
   {
-    struct list_elem free_elem; /* Free list element. */
+    size_t in_use;              /* Blocks allocated. */
+    size_t peak;                /* Most blocks ever allocated. */
+    int64_t allocs;             /* Number of allocations. */
   };
 
-/* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+/* Usage of each size class, and of big blocks in pages.
+   Protected by disabling interrupts. */
+static struct class_stat class_stats[CLASS_CNT];
+static struct class_stat big_stat;
+
+static void account_alloc (void *, size_t size, void *site);
+static void account_free (void *);
+#endif
 
-static struct arena *block_to_arena (struct block *);
-static struct block *arena_to_block (struct arena *, size_t idx);
+static void *alloc_block (size_t size);
+static struct big_block *block_to_big (void *);
 
-/* Initializes the malloc() descriptors. */
+/* Initializes the malloc() size classes. */
 void
 malloc_init (void) 
 {
-  size_t block_size;
+  size_t i, n;
 
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  ASSERT (class_sizes[CLASS_CNT - 1] == CLASS_MAX);
+
+  for (i = n = 0; i < CLASS_CNT; i++)
     {
-      struct desc *d = &descs[desc_cnt++];
-      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-      d->block_size = block_size;
-      d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-      list_init (&d->free_list);
-      lock_init (&d->lock);
+      char name[16];
+
+      snprintf (name, sizeof name, "malloc %zu", class_sizes[i]);
+      kmem_cache_init (&classes[i], name, class_sizes[i], NULL);
+      ASSERT (classes[i].size == class_sizes[i]);
+
+      for (; n * 8 <= class_sizes[i]; n++)
+        class_of[n] = i;
     }
 }
 
@@ -89,68 +99,40 @@ malloc_init (void)
 void *
 malloc (size_t size) 
 {
-  struct desc *d;
-  struct block *b;
-  struct arena *a;
+  void *p = alloc_block (size);
+#ifdef MEMSTAT
+  account_alloc (p, size, __builtin_return_address (0));
+#endif
+  return p;
+}
+
+/* Does the work of malloc().  The other allocation functions call
+   it directly, so that each can see its own caller. */
+static void *
+alloc_block (size_t size) 
+{
+  struct big_block *b;
+  size_t page_cnt;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
     return NULL;
 
-  /* Find the smallest descriptor that satisfies a SIZE-byte
-     request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
-  if (d == descs + desc_cnt) 
-    {
-      /* SIZE is too big for any descriptor.
-         Allocate enough pages to hold SIZE plus an arena. */
-      size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-      a = palloc_get_multiple (0, page_cnt);
-      if (a == NULL)
-        return NULL;
-
-      /* Initialize the arena to indicate a big block of PAGE_CNT
-         pages, and return it. */
-      a->magic = ARENA_MAGIC;
-      a->desc = NULL;
-      a->free_cnt = page_cnt;
-      return a + 1;
-    }
-
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
-    {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
+  if (size <= CLASS_MAX)
+    return kmem_cache_alloc (&classes[class_of[(size + 7) / 8]]);
 
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
-    }
+  /* SIZE is too big for any size class.
+     Allocate enough pages to hold SIZE plus a header. */
+  page_cnt = DIV_ROUND_UP (size + sizeof *b, PGSIZE);
+  b = palloc_get_multiple (0, page_cnt);
+  if (b == NULL)
+    return NULL;
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
-  return b;
+  /* Initialize the header to indicate a big block of PAGE_CNT
+     pages, and return it. */
+  b->magic = BIG_MAGIC;
+  b->page_cnt = page_cnt;
+  return b + 1;
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -167,9 +149,12 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = alloc_block (size);
   if (p != NULL)
     memset (p, 0, size);
+#ifdef MEMSTAT
+  account_alloc (p, size, __builtin_return_address (0));
+#endif
 
   return p;
 }
@@ -178,11 +163,12 @@ calloc (size_t a, size_t b)
 static size_t
 block_size (void *block) 
 {
-  struct block *b = block;
-  struct arena *a = block_to_arena (b);
-  struct desc *d = a->desc;
+  struct kmem_cache *c = kmem_cache_of (block);
 
-  return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
+  if (c != NULL)
+    return c->size;
+  else
+    return PGSIZE * block_to_big (block)->page_cnt - pg_ofs (block);
 }
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
@@ -201,7 +187,10 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = alloc_block (new_size);
+#ifdef MEMSTAT
+      account_alloc (new_block, new_size, __builtin_return_address (0));
+#endif
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -220,75 +209,115 @@ free (void *p)
 {
   if (p != NULL)
     {
-      struct block *b = p;
-      struct arena *a = block_to_arena (b);
-      struct desc *d = a->desc;
-      
-      if (d != NULL) 
-        {
-          /* It's a normal block.  We handle it here. */
+      struct kmem_cache *c = kmem_cache_of (p);
 
-#ifndef NDEBUG
-          /* Clear the block to help detect use-after-free bugs. */
-          memset (b, 0xcc, d->block_size);
+#ifdef MEMSTAT
+      account_free (p);
 #endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
-            {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
-            }
-
-          lock_release (&d->lock);
+      if (c != NULL)
+        {
+          /* It's a normal block.  Return it to its cache. */
+          kmem_cache_free (c, p);
         }
       else
         {
           /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
-          return;
+          struct big_block *b = block_to_big (p);
+          palloc_free_multiple (b, b->page_cnt);
         }
     }
 }
-
-/* Returns the arena that block B is inside. */
-static struct arena *
-block_to_arena (struct block *b)
+
+/* Returns the header of big block BLOCK. */
+static struct big_block *
+block_to_big (void *block)
 {
-  struct arena *a = pg_round_down (b);
+  struct big_block *b = pg_round_down (block);
 
-  /* Check that the arena is valid. */
-  ASSERT (a != NULL);
-  ASSERT (a->magic == ARENA_MAGIC);
+  /* Check that the header is valid. */
+  ASSERT (b != NULL);
+  ASSERT (b->magic == BIG_MAGIC);
+  ASSERT (pg_ofs (block) == sizeof *b);
 
-  /* Check that the block is properly aligned for the arena. */
-  ASSERT (a->desc == NULL
-          || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-  ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+  return b;
+}
 
-  return a;
+#ifdef MEMSTAT
+/* Charges BLOCK, a SIZE-byte allocation by the code that returns
+   to SITE, to its size class. */
+static void
+account_alloc (void *block, size_t size, void *site) 
+{
+  struct kmem_cache *c;
+  struct class_stat *s;
+  enum intr_level old_level;
+  size_t cnt = 1;
+
+  if (block == NULL)
+    return;
+
+  c = kmem_cache_of (block);
+  if (c != NULL)
+    s = &class_stats[c - classes];
+  else 
+    {
+      s = &big_stat;
+      cnt = block_to_big (block)->page_cnt;
+    }
+
+  old_level = intr_disable ();
+  s->allocs++;
+  s->in_use += cnt;
+  if (s->in_use > s->peak)
+    s->peak = s->in_use;
+  intr_set_level (old_level);
+
+  memstat_alloc (block, size, false, site);
+}
+
+/* Credits BLOCK, which is about to be freed, to its size
+   class. */
+static void
+account_free (void *block) 
+{
+  struct kmem_cache *c = kmem_cache_of (block);
+  enum intr_level old_level;
+
+  memstat_free (block);
+
+  old_level = intr_disable ();
+  if (c != NULL)
+    class_stats[c - classes].in_use--;
+  else
+    big_stat.in_use -= block_to_big (block)->page_cnt;
+  intr_set_level (old_level);
 }
 
-/* Returns the (IDX - 1)'th block within arena A. */
-static struct block *
-arena_to_block (struct arena *a, size_t idx) 
+/* Prints the usage of each size class and the fraction of slab
+   memory not in use by allocated blocks. */
+void
+malloc_print_stats (void) 
 {
-  ASSERT (a != NULL);
-  ASSERT (a->magic == ARENA_MAGIC);
-  ASSERT (idx < a->desc->blocks_per_arena);
-  return (struct block *) ((uint8_t *) a
-                           + sizeof *a
-                           + idx * a->desc->block_size);
+  size_t used_bytes = 0, slab_bytes = 0;
+  size_t i;
+
+  printf ("Malloc: %5s %8s %8s %10s %6s %5s\n",
+          "class", "in use", "peak", "allocs", "slabs", "idle");
+  for (i = 0; i < CLASS_CNT; i++) 
+    {
+      const struct class_stat *s = &class_stats[i];
+      const struct kmem_cache *c = &classes[i];
+
+      printf ("Malloc: %5zu %8zu %8zu %10lld %6zu %5zu\n",
+              c->size, s->in_use, s->peak, s->allocs, c->slab_cnt,
+              c->idle_cnt);
+      used_bytes += s->in_use * c->size;
+      slab_bytes += c->slab_cnt * PGSIZE;
+    }
+  printf ("Malloc: big blocks: %zu pages in use, peak %zu, %lld allocs\n",
+          big_stat.in_use, big_stat.peak, big_stat.allocs);
+  printf ("Malloc: %zu of %zu slab bytes in use, %zu%% fragmented\n",
+          used_bytes, slab_bytes,
+          slab_bytes != 0 ? 100 - used_bytes * 100 / slab_bytes : 0);
 }
+#endif
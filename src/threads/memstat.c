@@ -0,0 +1,198 @@
+#include "threads/memstat.h"
+#ifdef MEMSTAT
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+
+/* Allocation-site tagging.
+
+   malloc() and palloc_get_*() report every allocation, with the
+   return address of their caller, to memstat_alloc().  One in
+   every MEMSTAT_SAMPLE allocations is "tagged": it is entered in
+   a fixed-size hash table of outstanding allocations, and
+   charged to its call site.  Freeing a tagged allocation removes
+   it from the table and credits its site, so at any time each
+   site's charge estimates, scaled up by MEMSTAT_SAMPLE, how much
+   memory it holds.  Sites still charged at shutdown are likely
+   leakers.
+
+   Sites are printed as code addresses; use the `backtrace'
+   utility to translate them to function names.
+
+   Everything is protected by disabling interrupts, because pages
+   are freed with interrupts off by thread_schedule_tail(). */
+
+/* A call site. */
+struct site
+  {
+    void *addr;                 /* Return address of call. */
+    bool pages;                 /* Page allocation, not malloc()? */
+    int64_t tagged;             /* Tagged allocations ever. */
+    int64_t live_cnt;           /* Tagged allocations not yet freed. */
+    int64_t live_bytes;         /* Bytes in those allocations. */
+  };
+
+/* A tagged allocation. */
+struct tag
+  {
+    void *block;                /* Allocated block, or null. */
+    size_t size;                /* Size in bytes. */
+    struct site *site;          /* Call site. */
+  };
+
+static struct site sites[MEMSTAT_SITE_CNT];
+static size_t site_cnt;
+static struct tag tags[MEMSTAT_BLOCK_CNT];
+
+static unsigned alloc_cnt;      /* Allocations seen, for sampling. */
+static int64_t dropped_cnt;     /* Samples not tagged, table full. */
+
+/* Returns the index in tags[] where BLOCK's search begins. */
+static size_t
+tag_hash (const void *block) 
+{
+  return ((uintptr_t) block >> 3) * 2654435761u & (MEMSTAT_BLOCK_CNT - 1);
+}
+
+/* Returns the site for ADDR and PAGES, creating it if
+   necessary, or a null pointer if sites[] is full. */
+static struct site *
+find_site (void *addr, bool pages) 
+{
+  struct site *s;
+
+  for (s = sites; s < sites + site_cnt; s++)
+    if (s->addr == addr && s->pages == pages)
+      return s;
+  if (site_cnt >= MEMSTAT_SITE_CNT)
+    return NULL;
+
+  s = &sites[site_cnt++];
+  s->addr = addr;
+  s->pages = pages;
+  return s;
+}
+
+/* Records that the code that returns to SITE allocated BLOCK,
+   which is SIZE bytes long, using malloc() or, if PAGES is true,
+   the page allocator. */
+void
+memstat_alloc (void *block, size_t size, bool pages, void *site) 
+{
+  enum intr_level old_level;
+
+  if (block == NULL)
+    return;
+
+  old_level = intr_disable ();
+  if (++alloc_cnt % MEMSTAT_SAMPLE == 0) 
+    {
+      struct site *s = find_site (site, pages);
+      size_t i = tag_hash (block);
+      size_t probes;
+
+      for (probes = 0; s != NULL && probes < MEMSTAT_BLOCK_CNT; probes++)
+        {
+          struct tag *t = &tags[i];
+          if (t->block == NULL) 
+            {
+              t->block = block;
+              t->size = size;
+              t->site = s;
+              s->tagged++;
+              s->live_cnt++;
+              s->live_bytes += size;
+              break;
+            }
+          i = (i + 1) & (MEMSTAT_BLOCK_CNT - 1);
+        }
+      if (s == NULL || probes == MEMSTAT_BLOCK_CNT)
+        dropped_cnt++;
+    }
+  intr_set_level (old_level);
+}
+
+/* Records that BLOCK has been freed. */
+void
+memstat_free (void *block) 
+{
+  enum intr_level old_level;
+  size_t i, probes;
+
+  old_level = intr_disable ();
+  i = tag_hash (block);
+  for (probes = 0; probes < MEMSTAT_BLOCK_CNT && tags[i].block != NULL;
+       probes++) 
+    {
+      if (tags[i].block == block) 
+        {
+          struct tag *t = &tags[i];
+          size_t j;
+
+          t->site->live_cnt--;
+          t->site->live_bytes -= t->size;
+          t->block = NULL;
+
+          /* Move up later tags in the same run whose search would
+             otherwise no longer reach them. */
+          for (j = (i + 1) & (MEMSTAT_BLOCK_CNT - 1); tags[j].block != NULL;
+               j = (j + 1) & (MEMSTAT_BLOCK_CNT - 1)) 
+            {
+              size_t h = tag_hash (tags[j].block);
+              if (((j - h) & (MEMSTAT_BLOCK_CNT - 1))
+                  >= ((j - i) & (MEMSTAT_BLOCK_CNT - 1))) 
+                {
+                  tags[i] = tags[j];
+                  tags[j].block = NULL;
+                  i = j;
+                }
+            }
+          break;
+        }
+      i = (i + 1) & (MEMSTAT_BLOCK_CNT - 1);
+    }
+  intr_set_level (old_level);
+}
+
+/* Prints the MEMSTAT_TOP_N call sites that hold the most
+   memory, estimated from their tagged allocations. */
+void
+memstat_print (void) 
+{
+  struct site top[MEMSTAT_TOP_N];
+  enum intr_level old_level;
+  size_t top_cnt = 0;
+  size_t i, j;
+
+  /* Pick the top sites by insertion into TOP. */
+  old_level = intr_disable ();
+  for (i = 0; i < site_cnt; i++) 
+    {
+      const struct site *s = &sites[i];
+      if (s->live_cnt == 0)
+        continue;
+      for (j = top_cnt; j > 0 && top[j - 1].live_bytes < s->live_bytes; j--)
+        if (j < MEMSTAT_TOP_N)
+          top[j] = top[j - 1];
+      if (j < MEMSTAT_TOP_N) 
+        {
+          top[j] = *s;
+          if (top_cnt < MEMSTAT_TOP_N)
+            top_cnt++;
+        }
+    }
+  intr_set_level (old_level);
+
+  printf ("Memstat: %-10s %-6s %10s %12s %10s  (1 in %d sampled)\n",
+          "site", "kind", "live", "live bytes", "allocs", MEMSTAT_SAMPLE);
+  for (i = 0; i < top_cnt; i++)
+    printf ("Memstat: %-10p %-6s %10lld %12lld %10lld\n",
+            top[i].addr, top[i].pages ? "palloc" : "malloc",
+            top[i].live_cnt * MEMSTAT_SAMPLE,
+            top[i].live_bytes * MEMSTAT_SAMPLE,
+            top[i].tagged * MEMSTAT_SAMPLE);
+  if (dropped_cnt > 0)
+    printf ("Memstat: %lld samples dropped, tables full\n", dropped_cnt);
+}
+#endif /* MEMSTAT */
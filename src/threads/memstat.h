@@ -0,0 +1,29 @@
+#ifndef THREADS_MEMSTAT_H
+#define THREADS_MEMSTAT_H
+
+/* Memory allocator statistics and leak tracking, enabled by
+   building with -DMEMSTAT.  Without it, none of this is compiled
+   and the allocators do no extra work. */
+#ifdef MEMSTAT
+#include <stdbool.h>
+#include <stddef.h>
+
+/* One in this many allocations is tagged with its call site. */
+#define MEMSTAT_SAMPLE 4
+
+/* Maximum number of tagged allocations outstanding at once.
+   Must be a power of 2. */
+#define MEMSTAT_BLOCK_CNT 1024
+
+/* Maximum number of distinct call sites. */
+#define MEMSTAT_SITE_CNT 64
+
+/* Number of call sites printed by memstat_print(). */
+#define MEMSTAT_TOP_N 10
+
+void memstat_alloc (void *, size_t size, bool pages, void *site);
+void memstat_free (void *);
+void memstat_print (void);
+#endif
+
+#endif /* threads/memstat.h */
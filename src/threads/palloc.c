@@ -2,13 +2,15 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/memstat.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -25,12 +27,65 @@
    half to the user pool.  That should be huge overkill for the
    kernel pool, but that's just fine for demonstration purposes. */
 
-/* A memory pool. */
+/* Number of block sizes in the buddy allocator: blocks of 2**0
+   through 2**(PALLOC_ORDERS - 1) pages. */
+#define PALLOC_ORDERS 20
+
+/* Number of freed single pages that each pool caches in front of
+   its buddy system, and number of zeroed pages that the idle
+   thread keeps in reserve for each pool. */
+#define PAGE_CACHE_CNT 16
+#define ZERO_RESERVE_CNT 32
+
+/* A memory pool.
+
+   Each pool is a binary buddy system.  Its free pages are
+   grouped into blocks of 2**K pages, for some "order" K, whose
+   first page's index within the pool is a multiple of 2**K.  The
+   free blocks of each order are kept on a list, threaded through
+   the blocks' own first pages.  Allocating a block of order K
+   takes a block of the smallest available order J >= K and
+   splits it in halves, putting one half back each time, until it
+   has order K.  Freeing a block merges it with its "buddy", the
+   other half of the block of order K + 1 that it came from,
+   for as long as the buddy is also free.  Both take O(log n)
+   time in the size of the pool.
+
+   Single pages, by far the most common request, mostly bypass
+   the buddy system: freed pages go onto a small stack, the page
+   cache, and are handed out again from there in O(1) time.  In
+   addition, the idle thread keeps a reserve of zeroed pages,
+   so that palloc_get_page(PAL_ZERO) usually does not have to
+   clear a page on the caller's time.  Pages in the cache and the
+   reserve are marked free in the used map, but are not on the
+   free lists, so a multiple-page request that fails returns them
+   to the buddy system and tries again.
+
+   The pool is protected by disabling interrupts, not by a lock,
+   because thread_schedule_tail() frees the pages of a dying
+   thread with interrupts off, and every operation is short. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
+    const char *name;                   /* Name, for statistics. */
+    struct bitmap *used_map;            /* Bitmap of used pages. */
+    uint8_t *free_order;                /* 1 + order of free block at
+                                           each page, or 0. */
+    struct list free_lists[PALLOC_ORDERS]; /* Free blocks by order. */
+    uint32_t free_mask;                 /* Bit K set iff free_lists[K]
+                                           is nonempty. */
+    size_t page_cnt;                    /* Number of pages. */
+    size_t free_cnt;                    /* Free pages on free_lists. */
     uint8_t *base;                      /* Base of pool. */
+
+    void *cache[PAGE_CACHE_CNT];        /* Recently freed pages. */
+    size_t cache_cnt;                   /* Number of pages in cache. */
+    void *zeroed[ZERO_RESERVE_CNT];     /* Zeroed pages. */
+    size_t zeroed_cnt;                  /* Number of pages in zeroed. */
+
+#ifdef MEMSTAT
+    size_t used_cnt;                    /* Pages allocated. */
+    size_t peak_cnt;                    /* Most pages ever allocated. */
+#endif
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +94,14 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void *get_pages (enum palloc_flags, size_t page_cnt);
+static void *pool_get (struct pool *, size_t page_cnt);
+static void *cache_get (struct pool *, bool zero, bool *zeroed);
+static bool pool_drain (struct pool *);
+static void zero_reserve (struct pool *);
+static size_t buddy_alloc (struct pool *, int order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void print_pool_stats (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -61,34 +124,90 @@ palloc_init (size_t user_page_limit)
              user_pages, "user pool");
 }
 
+/* Returns the order of the smallest buddy block that holds
+   PAGE_CNT pages. */
+static int
+page_cnt_order (size_t page_cnt) 
+{
+  return page_cnt <= 1 ? 0 : 32 - __builtin_clz (page_cnt - 1);
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   FLAGS, in which case the kernel panics.
+
+   A single page comes from the pool's page cache or zeroed
+   reserve if possible.  Otherwise, the pages come from a free
+   buddy block of the next power of two in size, and the pages
+   beyond PAGE_CNT are freed again at once. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
+{
+  void *pages = get_pages (flags, page_cnt);
+#ifdef MEMSTAT
+  memstat_alloc (pages, PGSIZE * page_cnt, true, __builtin_return_address (0));
+#endif
+  return pages;
+}
+
+/* Obtains a single free page and returns its kernel virtual
+   address.
+   If PAL_USER is set, the page is obtained from the user pool,
+   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   then the page is filled with zeros.  If no pages are
+   available, returns a null pointer, unless PAL_ASSERT is set in
+   FLAGS, in which case the kernel panics. */
+void *
+palloc_get_page (enum palloc_flags flags) 
+{
+  void *page = get_pages (flags, 1);
+#ifdef MEMSTAT
+  memstat_alloc (page, PGSIZE, true, __builtin_return_address (0));
+#endif
+  return page;
+}
+
+/* Does the work of palloc_get_multiple() and palloc_get_page(),
+   which call it directly so that each can see its own caller. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
-  size_t page_idx;
+  enum intr_level old_level;
+  bool zeroed = false;
+  void *pages = NULL;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  old_level = intr_disable ();
+  if (page_cnt == 1)
+    pages = cache_get (pool, flags & PAL_ZERO, &zeroed);
+  if (pages == NULL) 
+    {
+      pages = pool_get (pool, page_cnt);
+      if (pages == NULL && pool_drain (pool))
+        pages = pool_get (pool, page_cnt);
+    }
+  if (pages != NULL) 
+    {
+      size_t page_idx = pg_no (pages) - pg_no (pool->base);
+      ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+      bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+#ifdef MEMSTAT
+      pool->used_cnt += page_cnt;
+      if (pool->used_cnt > pool->peak_cnt)
+        pool->peak_cnt = pool->used_cnt;
+#endif
+    }
+  intr_set_level (old_level);
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -100,24 +219,12 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
-/* Obtains a single free page and returns its kernel virtual
-   address.
-   If PAL_USER is set, the page is obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the page is filled with zeros.  If no pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
-void *
-palloc_get_page (enum palloc_flags flags) 
-{
-  return palloc_get_multiple (flags, 1);
-}
-
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
+  enum intr_level old_level;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
@@ -133,12 +240,27 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 
   page_idx = pg_no (pages) - pg_no (pool->base);
 
+#ifdef MEMSTAT
+  memstat_free (pages);
+#endif
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+#ifdef MEMSTAT
+  pool->used_cnt -= page_cnt;
+#endif
+  if (page_cnt == 1 && pool->cache_cnt < PAGE_CACHE_CNT)
+    pool->cache[pool->cache_cnt++] = pages;
+  else 
+    {
+      free_range (pool, page_idx, page_cnt);
+      pool->free_cnt += page_cnt;
+    }
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +270,61 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Tops up each pool's reserve of zeroed pages.  Called by the
+   idle thread, with interrupts on, whenever it is about to wait
+   for an interrupt, so that zeroing only uses otherwise idle
+   time. */
+void
+palloc_idle (void) 
+{
+  zero_reserve (&kernel_pool);
+  zero_reserve (&user_pool);
+}
+
+/* Prints fragmentation statistics for each pool. */
+void
+palloc_print_stats (void) 
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
+  /* We'll put the pool's used_map and free_order array at its
+     base.  Calculate the space needed for them and subtract it
+     from the pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t meta_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
+  if (meta_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  page_cnt -= meta_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  p->name = name;
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->free_order = (uint8_t *) base + bm_size;
+  memset (p->free_order, 0, page_cnt);
+  for (order = 0; order < PALLOC_ORDERS; order++)
+    list_init (&p->free_lists[order]);
+  p->free_mask = 0;
+  p->page_cnt = page_cnt;
+  p->free_cnt = page_cnt;
+  p->base = (uint8_t *) base + meta_pages * PGSIZE;
+  p->cache_cnt = p->zeroed_cnt = 0;
+#ifdef MEMSTAT
+  p->used_cnt = p->peak_cnt = 0;
+#endif
+
+  /* Put all of the pages on the free lists. */
+  free_range (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +334,269 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Allocates PAGE_CNT contiguous pages from POOL's buddy system
+   and returns the first one, or a null pointer if there is no
+   large enough free block.  Interrupts must be off. */
+static void *
+pool_get (struct pool *pool, size_t page_cnt) 
+{
+  int order = page_cnt_order (page_cnt);
+  size_t page_idx;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (order >= PALLOC_ORDERS)
+    return NULL;
+  page_idx = buddy_alloc (pool, order);
+  if (page_idx == BITMAP_ERROR)
+    return NULL;
+
+  free_range (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+  pool->free_cnt -= page_cnt;
+  return pool->base + PGSIZE * page_idx;
+}
+
+/* Takes a page from POOL's page cache or zeroed reserve, if
+   either is nonempty, and returns it, or returns a null pointer.
+   If ZERO is true, prefers a zeroed page, otherwise a cached
+   one.  Sets *ZEROED to true if the page is known to be zeroed.
+   Interrupts must be off. */
+static void *
+cache_get (struct pool *pool, bool zero, bool *zeroed) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (pool->zeroed_cnt > 0 && (zero || pool->cache_cnt == 0)) 
+    {
+      *zeroed = true;
+      return pool->zeroed[--pool->zeroed_cnt];
+    }
+  else if (pool->cache_cnt > 0)
+    return pool->cache[--pool->cache_cnt];
+  else
+    return NULL;
+}
+
+/* Returns the CNT pages in PAGES to POOL's buddy system.
+   Interrupts must be off. */
+static void
+free_pages (struct pool *pool, void **pages, size_t cnt) 
+{
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < cnt; i++)
+    free_range (pool, pg_no (pages[i]) - pg_no (pool->base), 1);
+  pool->free_cnt += cnt;
+}
+
+/* Returns all of the pages in POOL's page cache and zeroed
+   reserve to its buddy system.  Returns true if there were any.
+   Interrupts must be off. */
+static bool
+pool_drain (struct pool *pool) 
+{
+  bool drained = pool->cache_cnt > 0 || pool->zeroed_cnt > 0;
+
+  free_pages (pool, pool->cache, pool->cache_cnt);
+  free_pages (pool, pool->zeroed, pool->zeroed_cnt);
+  pool->cache_cnt = pool->zeroed_cnt = 0;
+  return drained;
+}
+
+/* Zeroes pages from POOL until it has ZERO_RESERVE_CNT zeroed
+   pages in reserve, or no free pages are left.  Pages are taken
+   from the page cache first, so that zeroing does not break up
+   buddy blocks while cached pages are at hand.  Then returns
+   whatever is left in the cache to the buddy system, so that it
+   can coalesce.  Only the idle thread adds to the reserve, so it
+   cannot overflow while a page is being zeroed. */
+static void
+zero_reserve (struct pool *pool) 
+{
+  enum intr_level old_level;
+
+  for (;;) 
+    {
+      void *page = NULL;
+
+      old_level = intr_disable ();
+      if (pool->zeroed_cnt < ZERO_RESERVE_CNT) 
+        {
+          if (pool->cache_cnt > 0)
+            page = pool->cache[--pool->cache_cnt];
+          else
+            page = pool_get (pool, 1);
+        }
+      intr_set_level (old_level);
+      if (page == NULL)
+        break;
+
+      memset (page, 0, PGSIZE);
+
+      old_level = intr_disable ();
+      ASSERT (pool->zeroed_cnt < ZERO_RESERVE_CNT);
+      pool->zeroed[pool->zeroed_cnt++] = page;
+      intr_set_level (old_level);
+    }
+
+  old_level = intr_disable ();
+  free_pages (pool, pool->cache, pool->cache_cnt);
+  pool->cache_cnt = 0;
+  intr_set_level (old_level);
+}
+
+/* Returns the list element stored in the page at PAGE_IDX in
+   POOL, which heads a free block. */
+static struct list_elem *
+block_elem (struct pool *pool, size_t page_idx) 
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Puts the block of the given ORDER at PAGE_IDX in POOL on its
+   free list. */
+static void
+block_push (struct pool *pool, size_t page_idx, int order) 
+{
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+  pool->free_order[page_idx] = order + 1;
+  pool->free_mask |= 1u << order;
+}
+
+/* Takes the free block of the given ORDER at PAGE_IDX in POOL
+   off its free list. */
+static void
+block_remove (struct pool *pool, size_t page_idx, int order) 
+{
+  ASSERT (pool->free_order[page_idx] == order + 1);
+
+  list_remove (block_elem (pool, page_idx));
+  pool->free_order[page_idx] = 0;
+  if (list_empty (&pool->free_lists[order]))
+    pool->free_mask &= ~(1u << order);
+}
+
+/* Allocates a block of 2**ORDER pages from POOL, splitting a
+   larger block if there is none of that size, and returns the
+   index of its first page, or BITMAP_ERROR if no block is large
+   enough.  Interrupts must be off. */
+static size_t
+buddy_alloc (struct pool *pool, int order) 
+{
+  uint32_t mask = pool->free_mask & ~((1u << order) - 1);
+  struct list_elem *e;
+  size_t page_idx;
+  int j;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (mask == 0)
+    return BITMAP_ERROR;
+
+  j = __builtin_ctz (mask);
+  e = list_front (&pool->free_lists[j]);
+  page_idx = ((uint8_t *) e - pool->base) / PGSIZE;
+  block_remove (pool, page_idx, j);
+
+  /* Give back the upper half until the block is small enough. */
+  while (j > order) 
+    {
+      j--;
+      block_push (pool, page_idx + ((size_t) 1 << j), j);
+    }
+  return page_idx;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL,
+   merging it with its buddy for as long as the buddy is free.
+   Interrupts must be off. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, int order) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (order + 1 < PALLOC_ORDERS) 
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+      if (buddy >= pool->page_cnt || pool->free_order[buddy] != order + 1)
+        break;
+      block_remove (pool, buddy, order);
+      page_idx &= ~((size_t) 1 << order);
+      order++;
+    }
+  block_push (pool, page_idx, order);
+}
+
+/* Frees PAGE_CNT pages starting at PAGE_IDX in POOL, as the
+   largest aligned buddy blocks that they divide into.
+   Interrupts must be off. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  while (page_cnt > 0) 
+    {
+      int order = page_idx != 0 ? __builtin_ctz (page_idx) : PALLOC_ORDERS - 1;
+      if (order > PALLOC_ORDERS - 1)
+        order = PALLOC_ORDERS - 1;
+      while (((size_t) 1 << order) > page_cnt)
+        order--;
+
+      buddy_free (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Prints the number of free pages in POOL, the number of free
+   blocks of each order, and the fraction of free pages outside
+   the largest free block, a measure of external fragmentation. */
+static void
+print_pool_stats (struct pool *pool) 
+{
+  enum intr_level old_level;
+  size_t blocks[PALLOC_ORDERS];
+  size_t free_cnt, cache_cnt, zeroed_cnt, largest;
+#ifdef MEMSTAT
+  size_t used_cnt, peak_cnt;
+#endif
+  int order;
+
+  old_level = intr_disable ();
+  for (order = 0; order < PALLOC_ORDERS; order++)
+    blocks[order] = list_size (&pool->free_lists[order]);
+  free_cnt = pool->free_cnt;
+  cache_cnt = pool->cache_cnt;
+  zeroed_cnt = pool->zeroed_cnt;
+#ifdef MEMSTAT
+  used_cnt = pool->used_cnt;
+  peak_cnt = pool->peak_cnt;
+#endif
+  intr_set_level (old_level);
+
+  largest = 0;
+  for (order = 0; order < PALLOC_ORDERS; order++)
+    if (blocks[order] != 0)
+      largest = (size_t) 1 << order;
+
+  printf ("Palloc: %s: %zu of %zu pages free, largest block %zu pages, "
+          "%zu%% fragmented\n", pool->name, free_cnt, pool->page_cnt,
+          largest, free_cnt != 0 ? 100 - largest * 100 / free_cnt : 0);
+  printf ("Palloc: %s: %zu pages cached, %zu zeroed\n",
+          pool->name, cache_cnt, zeroed_cnt);
+#ifdef MEMSTAT
+  printf ("Palloc: %s: %zu pages in use, peak %zu\n",
+          pool->name, used_cnt, peak_cnt);
+#endif
+  printf ("Palloc: %s: free blocks by order:", pool->name);
+  for (order = 0; order < PALLOC_ORDERS; order++)
+    if (blocks[order] != 0)
+      printf (" %d:%zu", order, blocks[order]);
+  printf ("\n");
+}
@@ -0,0 +1,335 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   An object cache hands out objects of one fixed size, rounded
+   up only as far as needed for alignment, so that frequently
+   allocated structures do not waste the space that rounding up
+   to a power of 2 would.
+
+   The objects live in "slabs".  A slab is a page that starts
+   with a `struct slab' header, followed by a stack of the
+   indexes of the slab's free objects, followed by the objects
+   themselves.  Keeping the free stack outside the objects means
+   that a free object keeps its contents, so a cache can have a
+   constructor that initializes each object only once, when its
+   slab is created: objects must be freed in their constructed
+   state.
+
+   A slab whose objects are all in use is on no list.  The cache
+   keeps slabs with some objects in use on its `partial' lists,
+   sorted by how many objects they have free, and allocates from
+   the fullest one.  That way allocations pack into as few slabs
+   as possible, and the others are left to empty out.  A slab
+   whose objects are all free goes on the cache's `idle' list, so
+   that churn does not repeatedly free and reallocate its page,
+   unless the cache already has `idle_max' idle slabs, in which
+   case it is returned to the page allocator.
+
+   In front of the slabs, each cache keeps a "magazine", a small
+   stack of free objects.  Allocating from or freeing to the
+   magazine only disables interrupts for a moment, instead of
+   taking the cache's lock.  When the magazine is empty, an
+   allocation takes the lock and refills it halfway from the
+   slabs; when it is full, a free takes the lock and empties it
+   halfway into the slabs. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab0bec
+
+/* Alignment of objects. */
+#define SLAB_ALIGN 8
+
+/* A slab. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in a `partial' or `idle' list. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free[];            /* Indexes of free objects. */
+  };
+
+static void *slab_alloc (struct kmem_cache *, bool grow);
+static void slab_free (struct kmem_cache *, void *obj);
+static void slab_destroy (struct kmem_cache *, struct slab *);
+
+/* Initializes C as a cache of SIZE-byte objects named NAME.  If
+   CTOR is nonnull, it is called on each object when the slab
+   that contains it is created. */
+void
+kmem_cache_init (struct kmem_cache *c, const char *name, size_t size,
+                 kmem_ctor_func *ctor) 
+{
+  size_t n, i;
+
+  ASSERT (c != NULL);
+  ASSERT (name != NULL);
+
+  size = ROUND_UP (size > 0 ? size : 1, SLAB_ALIGN);
+
+  /* Fit as many objects as possible, with their free stack
+     entries, into a slab. */
+  n = (PGSIZE - sizeof (struct slab)) / (size + sizeof (uint16_t));
+  while (n > 0
+         && ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                      SLAB_ALIGN) + n * size > PGSIZE)
+    n--;
+  ASSERT (n > 0);
+
+  strlcpy (c->name, name, sizeof c->name);
+  c->size = size;
+  c->objs_per_slab = n;
+  c->obj_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                         SLAB_ALIGN);
+  c->ctor = ctor;
+  c->magazine_cnt = 0;
+  lock_init_adaptive (&c->lock, c->name);
+  for (i = 0; i < KMEM_PARTIAL_LISTS; i++)
+    list_init (&c->partial[i]);
+  list_init (&c->idle);
+  c->idle_cnt = 0;
+  c->idle_max = KMEM_IDLE_SLABS;
+  c->slab_cnt = 0;
+}
+
+/* Creates and returns a new cache of SIZE-byte objects named
+   NAME, or returns a null pointer if memory is not available.
+   If CTOR is nonnull, it is called on each object when the slab
+   that contains it is created. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor) 
+{
+  struct kmem_cache *c = malloc (sizeof *c);
+  if (c != NULL)
+    kmem_cache_init (c, name, size, ctor);
+  return c;
+}
+
+/* Obtains and returns a free object from cache C, or returns a
+   null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) 
+{
+  enum intr_level old_level;
+  void *obj = NULL;
+
+  ASSERT (c != NULL);
+
+  old_level = intr_disable ();
+  if (c->magazine_cnt > 0)
+    obj = c->magazine[--c->magazine_cnt];
+  intr_set_level (old_level);
+  if (obj != NULL)
+    return obj;
+
+  /* Slow path: take an object from the slabs, and refill the
+     magazine from slabs that already exist. */
+  lock_acquire (&c->lock);
+  obj = slab_alloc (c, true);
+  if (obj != NULL) 
+    {
+      old_level = intr_disable ();
+      while (c->magazine_cnt < KMEM_MAGAZINE_SIZE / 2) 
+        {
+          void *extra = slab_alloc (c, false);
+          if (extra == NULL)
+            break;
+          c->magazine[c->magazine_cnt++] = extra;
+        }
+      intr_set_level (old_level);
+    }
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Frees OBJ, which must have been allocated from cache C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) 
+{
+  void *flush[KMEM_MAGAZINE_SIZE / 2];
+  enum intr_level old_level;
+  size_t flush_cnt = 0;
+  size_t i;
+
+  ASSERT (kmem_cache_of (obj) == c);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     it has to stay constructed. */
+  if (c->ctor == NULL)
+    memset (obj, 0xcc, c->size);
+#endif
+
+  old_level = intr_disable ();
+  if (c->magazine_cnt == KMEM_MAGAZINE_SIZE)
+    while (flush_cnt < KMEM_MAGAZINE_SIZE / 2)
+      flush[flush_cnt++] = c->magazine[--c->magazine_cnt];
+  c->magazine[c->magazine_cnt++] = obj;
+  intr_set_level (old_level);
+
+  /* Slow path: give the objects flushed from the magazine back to
+     their slabs. */
+  if (flush_cnt > 0) 
+    {
+      lock_acquire (&c->lock);
+      for (i = 0; i < flush_cnt; i++)
+        slab_free (c, flush[i]);
+      lock_release (&c->lock);
+    }
+}
+
+/* Returns the cache that OBJ was allocated from, or a null
+   pointer if OBJ is not in a slab. */
+struct kmem_cache *
+kmem_cache_of (void *obj) 
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (obj != NULL);
+
+  if (s->magic != SLAB_MAGIC)
+    return NULL;
+  ASSERT ((pg_ofs (obj) - s->cache->obj_ofs) % s->cache->size == 0);
+  return s->cache;
+}
+
+/* Makes cache C keep up to IDLE_MAX entirely free slabs, instead
+   of returning them to the page allocator, and returns any idle
+   slabs beyond that at once. */
+void
+kmem_cache_set_idle (struct kmem_cache *c, size_t idle_max) 
+{
+  lock_acquire (&c->lock);
+  c->idle_max = idle_max;
+  while (c->idle_cnt > idle_max) 
+    {
+      struct slab *s = list_entry (list_pop_front (&c->idle),
+                                   struct slab, elem);
+      c->idle_cnt--;
+      slab_destroy (c, s);
+    }
+  lock_release (&c->lock);
+}
+
+/* Returns the IDX'th object in slab S of cache C. */
+static void *
+slab_obj (struct kmem_cache *c, struct slab *s, size_t idx) 
+{
+  return (uint8_t *) s + c->obj_ofs + idx * c->size;
+}
+
+/* Creates a new slab for cache C, constructs its objects, and
+   puts it on C's idle list.  Returns false if memory is not
+   available. */
+static bool
+slab_create (struct kmem_cache *c) 
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return false;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++) 
+    {
+      s->free[i] = c->objs_per_slab - 1 - i;
+      if (c->ctor != NULL)
+        c->ctor (slab_obj (c, s, i));
+    }
+  list_push_front (&c->idle, &s->elem);
+  c->idle_cnt++;
+  c->slab_cnt++;
+  return true;
+}
+
+/* Returns slab S of cache C, all of whose objects are free, to
+   the page allocator. */
+static void
+slab_destroy (struct kmem_cache *c, struct slab *s) 
+{
+  ASSERT (s->free_cnt == c->objs_per_slab);
+
+  s->magic = 0;
+  palloc_free_page (s);
+  c->slab_cnt--;
+}
+
+/* Puts slab S of cache C on the list that matches its number of
+   free objects.  S must not be on any list. */
+static void
+slab_file (struct kmem_cache *c, struct slab *s) 
+{
+  if (s->free_cnt == 0)
+    return;
+  else if (s->free_cnt < c->objs_per_slab)
+    list_push_front (&c->partial[s->free_cnt * KMEM_PARTIAL_LISTS
+                                 / c->objs_per_slab],
+                     &s->elem);
+  else if (c->idle_cnt < c->idle_max) 
+    {
+      list_push_front (&c->idle, &s->elem);
+      c->idle_cnt++;
+    }
+  else
+    slab_destroy (c, s);
+}
+
+/* Takes a free object from one of cache C's slabs and returns
+   it.  Prefers the fullest partly used slab, then an idle slab.
+   If there is neither, creates a new slab if GROW is true,
+   otherwise returns a null pointer.  C's lock must be held. */
+static void *
+slab_alloc (struct kmem_cache *c, bool grow) 
+{
+  struct slab *s = NULL;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  for (i = 0; i < KMEM_PARTIAL_LISTS; i++)
+    if (!list_empty (&c->partial[i])) 
+      {
+        s = list_entry (list_pop_front (&c->partial[i]), struct slab, elem);
+        break;
+      }
+  if (s == NULL) 
+    {
+      if (!grow || (list_empty (&c->idle) && !slab_create (c)))
+        return NULL;
+      s = list_entry (list_pop_front (&c->idle), struct slab, elem);
+      c->idle_cnt--;
+    }
+
+  ASSERT (s->free_cnt > 0);
+  s->free_cnt--;
+  slab_file (c, s);
+  return slab_obj (c, s, s->free[s->free_cnt]);
+}
+
+/* Returns OBJ to its slab in cache C.  C's lock must be held. */
+static void
+slab_free (struct kmem_cache *c, void *obj) 
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (s->magic == SLAB_MAGIC && s->cache == c);
+  ASSERT (s->free_cnt < c->objs_per_slab);
+
+  if (s->free_cnt > 0)
+    list_remove (&s->elem);
+  s->free[s->free_cnt++] = (pg_ofs (obj) - c->obj_ofs) / c->size;
+  slab_file (c, s);
+}
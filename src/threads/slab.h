@@ -0,0 +1,57 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Number of free objects that a cache can keep at hand in its
+   magazine. */
+#define KMEM_MAGAZINE_SIZE 16
+
+/* Number of lists that partially used slabs are sorted into by
+   how full they are. */
+#define KMEM_PARTIAL_LISTS 8
+
+/* Default number of entirely free slabs that a cache keeps
+   instead of returning them to the page allocator. */
+#define KMEM_IDLE_SLABS 1
+
+/* Constructor for the objects in a cache. */
+typedef void kmem_ctor_func (void *obj);
+
+/* An object cache, which hands out objects of a single size
+   carved out of page-size slabs.  See slab.c for details.
+   Caches are never destroyed. */
+struct kmem_cache
+  {
+    char name[16];              /* Name, for statistics. */
+    size_t size;                /* Object size in bytes. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t obj_ofs;             /* Offset of first object in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+
+    /* Fast path, protected by disabling interrupts. */
+    void *magazine[KMEM_MAGAZINE_SIZE]; /* Free objects at hand. */
+    size_t magazine_cnt;        /* Number of objects in magazine. */
+
+    /* Slow path. */
+    struct lock lock;           /* Protects the members below. */
+    struct list partial[KMEM_PARTIAL_LISTS]; /* Partly used slabs,
+                                           fullest first. */
+    struct list idle;           /* Entirely free slabs. */
+    size_t idle_cnt;            /* Number of slabs in idle. */
+    size_t idle_max;            /* Maximum idle_cnt. */
+    size_t slab_cnt;            /* Number of slabs. */
+  };
+
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t size,
+                      kmem_ctor_func *);
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+struct kmem_cache *kmem_cache_of (void *);
+void kmem_cache_set_idle (struct kmem_cache *, size_t idle_max);
+
+#endif /* threads/slab.h */
@@ -29,9 +29,26 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
+#include "threads/cycles.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+#ifdef LOCKSTAT
+/* Use the functions, not the lockstat wrappers, in this file. */
+#undef lock_init
+#undef lock_init_adaptive
+#undef rwlock_init
+#endif
+
+static void waitq_init (struct waitq *);
+static bool waitq_empty (const struct waitq *);
+static int waitq_max_priority (const struct waitq *);
+static void waitq_push (struct waitq *, struct thread *);
+static struct thread *waitq_pop (struct waitq *);
+static void wakeup_preempt (enum intr_level old_level);
+static void lock_spin (struct lock *);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -47,7 +64,7 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  waitq_init (&sema->waiters);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -57,17 +74,6 @@ sema_init (struct semaphore *sema, unsigned value)
    interrupt handler.  This function may be called with
    interrupts disabled, but if it sleeps then the next scheduled
    thread will probably turn interrupts back on. */
-   bool
-thread_priority_less_2 (const struct list_elem *a,
-                             const struct list_elem *b,
-                             void *aux)
-                             {
-  struct thread *ta = list_entry (a, struct thread, elem);
-  struct thread *tb = list_entry (b, struct thread, elem);
-  if(ta->priority>tb->priority)
-    return true;
-    return false;
-}
 void
 sema_down (struct semaphore *sema) 
 {
@@ -79,7 +85,7 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
+      waitq_push (&sema->waiters, thread_current ());
       thread_block ();
     }
   sema->value--;
@@ -113,26 +119,46 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any, yielding to it if it outranks the running
+   thread.
 
    This function may be called from an interrupt handler. */
 void
 sema_up (struct semaphore *sema) 
 {
   enum intr_level old_level;
+  bool preempt = false;
 
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters)) 
+  sema->value++;
+  if (!waitq_empty (&sema->waiters)) 
     {
-      list_sort(&sema->waiters, thread_priority_less_2, NULL);
-      thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+      struct thread *t = waitq_pop (&sema->waiters);
+      thread_unblock (t);
+      preempt = t->priority > thread_current ()->priority;
     }
-  sema->value++;
-  thread_yield();
   intr_set_level (old_level);
+
+  if (preempt)
+    wakeup_preempt (old_level);
+}
+
+/* Yields the CPU to a higher-priority thread that was just woken
+   up.  In an interrupt handler, yields on return from the
+   interrupt.  Does not yield if the caller had interrupts
+   disabled (OLD_LEVEL), since it may rely on running atomically
+   until it turns them back on; the next timer tick preempts it
+   instead. */
+static void
+wakeup_preempt (enum intr_level old_level) 
+{
+  if (intr_context ())
+    intr_yield_on_return ();
+  else if (old_level == INTR_ON)
+    thread_yield ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -193,9 +219,86 @@ lock_init (struct lock *lock)
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
+  lock->priority = PRI_MIN;
+  lock->adaptive = false;
+  lock->name = NULL;
+  lock->acquisitions = lock->contended = lock->wait_ticks = 0;
+#ifdef LOCKSTAT
+  lock->stat = NULL;
+  lock->waiters = 0;
+#endif
   sema_init (&lock->semaphore, 1);
 }
 
+/* Adaptive locks whose statistics are printed at shutdown. */
+static struct list adaptive_locks = LIST_INITIALIZER (adaptive_locks);
+
+/* Initializes LOCK like lock_init(), but makes it adaptive: a
+   thread that finds LOCK held by a thread that is ready to run,
+   that is, one that was preempted inside its critical section,
+   yields to the holder up to LOCK_SPIN_CNT times in the hope
+   that it releases LOCK, before blocking.  This suits locks that
+   are only held for short stretches, where blocking and waking
+   up costs more than the critical section itself.
+
+   LOCK's contention statistics are printed under NAME by
+   lock_print_stats(), so LOCK must never be freed. */
+void
+lock_init_adaptive (struct lock *lock, const char *name) 
+{
+  ASSERT (name != NULL);
+
+  lock_init (lock);
+  lock->adaptive = true;
+  lock->name = name;
+  list_push_back (&adaptive_locks, &lock->stats_elem);
+}
+
+/* Donates PRIORITY to the holder of LOCK, and on along the chain
+   of locks that each holder is itself waiting for, at most
+   LOCK_DONATION_DEPTH locks deep.  Interrupts must be off. */
+static void
+lock_donate (struct lock *lock, int priority) 
+{
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; depth < LOCK_DONATION_DEPTH; depth++)
+    {
+      /* If LOCK already carries PRIORITY, then so does the rest
+         of the chain. */
+      if (lock == NULL || lock->holder == NULL || lock->priority >= priority)
+        break;
+
+      lock->priority = priority;
+      thread_donate_priority (lock->holder, priority);
+      lock = lock->holder->waiting_lock;
+    }
+}
+
+/* Makes the current thread the holder of LOCK, which it has just
+   downed.  Threads still waiting for LOCK keep donating their
+   priority to the new holder.  Interrupts must be off. */
+static void
+lock_take (struct lock *lock) 
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  lock->holder = cur;
+  list_push_back (&cur->locks_held, &lock->elem);
+#ifdef LOCKSTAT
+  lock->acquire_cycles = rdtsc ();
+#endif
+  if (!thread_mlfqs)
+    {
+      lock->priority = waitq_max_priority (&lock->semaphore.waiters);
+      thread_donate_priority (cur, lock->priority);
+    }
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
@@ -207,6 +310,7 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
   enum intr_level old_level;
 
   ASSERT (lock != NULL);
@@ -214,24 +318,67 @@ lock_acquire (struct lock *lock)
   ASSERT (!lock_held_by_current_thread (lock));
 
   old_level = intr_disable ();
-  
-  if(lock->holder != NULL && thread_current()->priority > lock->holder->priority)
-  {
-    struct thread* t = thread_current();
-    list_push_front(lock->holder->donation_list, t);
-    int temp = lock->holder->priority;
-    lock->holder->priority = t->priority;
-    t->priority = lock->holder->priority;
-
-    if(lock->holder->status == THREAD_BLOCKED)
-      thread_unblock(lock->holder);
-  }
-  sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
-  
+  lock->acquisitions++;
+  if (lock->holder != NULL)
+    {
+      int64_t start = timer_ticks ();
+#ifdef LOCKSTAT
+      uint64_t wait_start = rdtsc ();
+      lock->waiters++;
+      if (lock->stat != NULL && lock->waiters > lock->stat->max_waiters)
+        lock->stat->max_waiters = lock->waiters;
+#endif
+
+      lock->contended++;
+      cur->waiting_lock = lock;
+      if (lock->adaptive)
+        lock_spin (lock);
+      if (lock->holder != NULL && !thread_mlfqs)
+        lock_donate (lock, cur->priority);
+      sema_down (&lock->semaphore);
+      cur->waiting_lock = NULL;
+      lock->wait_ticks += timer_ticks () - start;
+#ifdef LOCKSTAT
+      lock->waiters--;
+      if (lock->stat != NULL)
+        lock->stat->wait_cycles += rdtsc () - wait_start;
+#endif
+    }
+  else
+    sema_down (&lock->semaphore);
+  lock_take (lock);
   intr_set_level (old_level);
 }
 
+/* Yields the CPU to the holder of adaptive LOCK for as long as
+   the holder is ready to run, at most LOCK_SPIN_CNT times, so
+   that it can finish its critical section and release LOCK
+   without the current thread ever blocking.  Gives up at once if
+   the holder is blocked, since it may stay blocked for a long
+   time.  The holder must be lent the current thread's priority,
+   or it would never run in preference to us.  Interrupts must be
+   off. */
+static void
+lock_spin (struct lock *lock) 
+{
+  struct thread *cur = thread_current ();
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < LOCK_SPIN_CNT; i++) 
+    {
+      struct thread *holder = lock->holder;
+      if (holder == NULL || holder->status != THREAD_READY)
+        break;
+      if (!thread_mlfqs)
+        lock_donate (lock, cur->priority);
+      else if (holder->priority < cur->priority)
+        break;
+      thread_yield ();
+    }
+}
+
 /* Tries to acquires LOCK and returns true if successful or false
    on failure.  The lock must not already be held by the current
    thread.
@@ -241,14 +388,20 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->acquisitions++;
+      lock_take (lock);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -260,10 +413,24 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  /* Give back whatever was donated through LOCK. */
+  old_level = intr_disable ();
+#ifdef LOCKSTAT
+  if (lock->stat != NULL)
+    lock->stat->hold_cycles += rdtsc () - lock->acquire_cycles;
+#endif
+  list_remove (&lock->elem);
   lock->holder = NULL;
+  lock->priority = PRI_MIN;
+  if (!thread_mlfqs)
+    thread_recompute_priority (thread_current ());
+  intr_set_level (old_level);
+
   sema_up (&lock->semaphore);
 }
 
@@ -277,14 +444,90 @@ lock_held_by_current_thread (const struct lock *lock)
 
   return lock->holder == thread_current ();
 }
-
-/* One semaphore in a list. */
-struct semaphore_elem 
-  {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
-  };
 
+/* Prints contention statistics for the adaptive locks. */
+void
+lock_print_stats (void) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&adaptive_locks); e != list_end (&adaptive_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, stats_elem);
+      if (lock->acquisitions > 0)
+        printf ("Lock %s: %lld acquisitions, %lld contended, "
+                "%lld wait ticks\n", lock->name, lock->acquisitions,
+                lock->contended, lock->wait_ticks);
+    }
+}
+
+#ifdef LOCKSTAT
+/* All of the lockstats that have ever had a lock attached. */
+static struct list lockstats = LIST_INITIALIZER (lockstats);
+
+/* Makes STAT, which must be in static storage, accumulate the
+   statistics of LOCK. */
+void
+lockstat_attach (struct lock *lock, struct lockstat *stat) 
+{
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+  ASSERT (stat != NULL);
+
+  old_level = intr_disable ();
+
+  /* STAT starts out zeroed, so a null `next' pointer shows that
+     it is not in the list yet. */
+  if (stat->elem.next == NULL)
+    list_push_back (&lockstats, &stat->elem);
+  lock->stat = stat;
+  intr_set_level (old_level);
+}
+
+/* Returns true if lockstat A_ shows more time spent waiting than
+   B_, or if they are equal, more time spent held. */
+static bool
+lockstat_more (const struct list_elem *a_, const struct list_elem *b_,
+               void *aux UNUSED) 
+{
+  const struct lockstat *a = list_entry (a_, struct lockstat, elem);
+  const struct lockstat *b = list_entry (b_, struct lockstat, elem);
+
+  if (a->wait_cycles != b->wait_cycles)
+    return a->wait_cycles > b->wait_cycles;
+  return a->hold_cycles > b->hold_cycles;
+}
+
+/* Prints the LOCKSTAT_TOP_N lockstats with the most time spent
+   waiting.  Acquisition and contention counts are per lock, in
+   `struct lock'; lock_print_stats() prints them for named
+   locks. */
+void
+lockstat_print (void) 
+{
+  struct list_elem *e;
+  int i;
+
+  list_sort (&lockstats, lockstat_more, NULL);
+
+  printf ("Lockstat: %-40s %14s %14s %7s\n", "lock",
+          "wait cycles", "hold cycles", "waiters");
+  for (e = list_begin (&lockstats), i = 0;
+       e != list_end (&lockstats) && i < LOCKSTAT_TOP_N;
+       e = list_next (e), i++)
+    {
+      struct lockstat *s = list_entry (e, struct lockstat, elem);
+      char name[41];
+
+      snprintf (name, sizeof name, "%s (%s:%d)", s->name, s->file, s->line);
+      printf ("Lockstat: %-40s %14llu %14llu %7d\n", name,
+              s->wait_cycles, s->hold_cycles, s->max_waiters);
+    }
+}
+#endif
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -293,7 +536,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  waitq_init (&cond->waiters);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -316,33 +559,24 @@ cond_init (struct condition *cond)
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
    we need to sleep. */
-
-bool
-thread_priority_less_3 (const struct list_elem *a,
-                             const struct list_elem *b,
-                             void *aux)
-                             {
-  struct thread* ta=list_entry(list_begin( &(&list_entry(a, struct semaphore_elem, elem)->semaphore)->waiters) , struct thread, elem);
-  struct thread* tb=list_entry(list_begin( &(&list_entry(b, struct semaphore_elem, elem)->semaphore)->waiters), struct thread, elem);
-  if(ta->priority>tb->priority)
-    return true;
-    return false;
-}
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
-  struct semaphore_elem waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
-  
-  sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
 
+  /* Joining COND's queue, releasing LOCK and blocking must be
+     atomic, so that a signal cannot slip in between. */
+  old_level = intr_disable ();
+  waitq_push (&cond->waiters, thread_current ());
   lock_release (lock);
-  sema_down (&waiter.semaphore);
+  thread_block ();
+  intr_set_level (old_level);
+
   lock_acquire (lock);
 }
 
@@ -356,17 +590,25 @@ cond_wait (struct condition *cond, struct lock *lock)
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) 
 {
+  enum intr_level old_level;
+  bool preempt = false;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters)) 
+  old_level = intr_disable ();
+  if (!waitq_empty (&cond->waiters)) 
     {
-      list_sort(&cond->waiters, thread_priority_less_3, NULL);
-      sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+      struct thread *t = waitq_pop (&cond->waiters);
+      thread_unblock (t);
+      preempt = t->priority > thread_current ()->priority;
     }
+  intr_set_level (old_level);
+
+  if (preempt)
+    wakeup_preempt (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -381,6 +623,415 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!waitq_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW as an unheld readers-writer lock.  If DONATE is
+   true, writers waiting for RW donate their priority to the
+   threads reading it, which costs a little more per read
+   acquisition. */
+void
+rwlock_init (struct rwlock *rw, bool donate) 
+{
+  size_t i;
+
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->writer);
+  rw->readers = 0;
+  rw->writers_waiting = 0;
+  waitq_init (&rw->read_waiters);
+  rw->drainer = NULL;
+  rw->donate = donate;
+  for (i = 0; i < RWLOCK_READER_SLOTS; i++) 
+    {
+      rw->reader_slots[i].thread = NULL;
+      rw->reader_slots[i].rwlock = rw;
+    }
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   is waiting for it.  The current thread must not already hold
+   RW, for reading or for writing: a second read acquisition
+   would deadlock against a waiting writer.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  size_t i;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rw));
+
+  old_level = intr_disable ();
+  while (rw->writer.holder != NULL || rw->writers_waiting > 0) 
+    {
+      cur->waiting_lock = &rw->writer;
+      if (!thread_mlfqs)
+        lock_donate (&rw->writer, cur->priority);
+      waitq_push (&rw->read_waiters, cur);
+      thread_block ();
+      cur->waiting_lock = NULL;
+    }
+  rw->readers++;
+  if (rw->donate)
+    for (i = 0; i < RWLOCK_READER_SLOTS; i++)
+      if (rw->reader_slots[i].thread == NULL) 
+        {
+          rw->reader_slots[i].thread = cur;
+          list_push_back (&cur->rwlocks_read, &rw->reader_slots[i].elem);
+          break;
+        }
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread holds for reading.  The
+   last reader out admits the writer waiting for RW, if any. */
+void
+rwlock_release_read (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  int old_priority = cur->priority;
+  enum intr_level old_level;
+  bool preempt = false;
+  size_t i;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (rw->readers > 0);
+  rw->readers--;
+  if (rw->donate) 
+    {
+      for (i = 0; i < RWLOCK_READER_SLOTS; i++)
+        if (rw->reader_slots[i].thread == cur) 
+          {
+            rw->reader_slots[i].thread = NULL;
+            list_remove (&rw->reader_slots[i].elem);
+            break;
+          }
+
+      /* Give back what RW's writer donated to us.  Writers
+         waiting for other rwlocks that we still read keep
+         donating through our `rwlocks_read'. */
+      if (!thread_mlfqs)
+        thread_recompute_priority (cur);
+      preempt = cur->priority < old_priority;
+    }
+  if (rw->readers == 0 && rw->drainer != NULL) 
+    {
+      struct thread *t = rw->drainer;
+      rw->drainer = NULL;
+      thread_unblock (t);
+      preempt = preempt || t->priority > cur->priority;
+    }
+  intr_set_level (old_level);
+
+  if (preempt)
+    wakeup_preempt (old_level);
+}
+
+/* Donates PRIORITY to each thread reading RW that fits in its
+   reader slots, and on along the locks those readers are waiting
+   for.  Interrupts must be off. */
+static void
+rwlock_donate_readers (struct rwlock *rw, int priority) 
+{
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < RWLOCK_READER_SLOTS; i++) 
+    {
+      struct thread *t = rw->reader_slots[i].thread;
+      if (t != NULL && t->priority < priority) 
+        {
+          thread_donate_priority (t, priority);
+          lock_donate (t->waiting_lock, priority);
+        }
+    }
+}
+
+/* Acquires RW for writing, sleeping until no other writer holds
+   it and every reader has released it.  The current thread must
+   not already hold RW.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  rw->writers_waiting++;
+  lock_acquire (&rw->writer);
+
+  /* lock_take() only counted the threads waiting for RW->writer
+     itself, not the readers queued up behind the writers, so
+     they have to donate to us again. */
+  if (!thread_mlfqs)
+    lock_donate (&rw->writer, waitq_max_priority (&rw->read_waiters));
+  while (rw->readers > 0) 
+    {
+      if (rw->donate && !thread_mlfqs)
+        rwlock_donate_readers (rw, cur->priority);
+      rw->drainer = cur;
+      thread_block ();
+    }
+  rw->writers_waiting--;
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread holds for writing.  The
+   next waiting writer, if any, gets RW next; otherwise all of the
+   waiting readers are admitted at once. */
+void
+rwlock_release_write (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int woken_priority;
+
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_for_write (rw));
+
+  old_level = intr_disable ();
+  woken_priority = waitq_max_priority (&rw->writer.semaphore.waiters);
+  lock_release (&rw->writer);
+  if (rw->writers_waiting == 0)
+    while (!waitq_empty (&rw->read_waiters)) 
+      {
+        struct thread *t = waitq_pop (&rw->read_waiters);
+        thread_unblock (t);
+        if (t->priority > woken_priority)
+          woken_priority = t->priority;
+      }
+  intr_set_level (old_level);
+
+  if (woken_priority > cur->priority)
+    wakeup_preempt (old_level);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise. */
+bool
+rwlock_held_for_write (const struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  return lock_held_by_current_thread (&rw->writer);
+}
+
+/* Wait queues.
+
+   A wait queue holds the threads blocked on a semaphore or
+   condition variable as a pairing heap, threaded through the
+   threads' `wq_*' members.  The heap is ordered by priority, and
+   among equal priorities by arrival, so that waking the
+   highest-priority waiter is O(log n) amortized instead of a
+   sort or a scan, joining the queue is O(1), and raising the
+   priority of a blocked waiter (by donation) is O(1).
+
+   In the heap, each node points to its leftmost child, to its
+   right sibling (`wq_next'), and back to its left sibling or, if
+   it is the leftmost child, to its parent (`wq_prev').  The
+   root's `wq_next' and `wq_prev' are null.
+
+   Wait queues must be manipulated with interrupts off. */
+
+/* Arrival counter, to keep equal-priority waiters in FIFO
+   order. */
+static int64_t waitq_seq;
+
+/* Initializes Q as an empty wait queue. */
+static void
+waitq_init (struct waitq *q) 
+{
+  q->root = NULL;
+}
+
+/* Returns true if Q is empty. */
+static bool
+waitq_empty (const struct waitq *q) 
+{
+  return q->root == NULL;
+}
+
+/* Returns the highest priority in Q, or PRI_MIN if Q is
+   empty. */
+static int
+waitq_max_priority (const struct waitq *q) 
+{
+  return q->root != NULL ? q->root->priority : PRI_MIN;
+}
+
+/* Returns true if A should be woken before B. */
+static inline bool
+waitq_before (const struct thread *a, const struct thread *b) 
+{
+  return (a->priority > b->priority
+          || (a->priority == b->priority && a->wq_seq < b->wq_seq));
+}
+
+/* Links heaps A and B, either of which may be null, and returns
+   the root of the result.  A and B must not have siblings. */
+static struct thread *
+waitq_meld (struct thread *a, struct thread *b) 
+{
+  struct thread *t;
+
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (waitq_before (b, a))
+    {
+      t = a;
+      a = b;
+      b = t;
+    }
+
+  /* Make B the leftmost child of A. */
+  b->wq_prev = a;
+  b->wq_next = a->wq_child;
+  if (a->wq_child != NULL)
+    a->wq_child->wq_prev = b;
+  a->wq_child = b;
+  return a;
+}
+
+/* Melds the sibling list that starts at FIRST into a single heap
+   and returns its root, using the standard two-pass scheme: meld
+   pairs left to right, then meld the results right to left. */
+static struct thread *
+waitq_meld_siblings (struct thread *first) 
+{
+  struct thread *pairs = NULL;
+  struct thread *root = NULL;
+
+  while (first != NULL)
+    {
+      struct thread *a = first;
+      struct thread *b = a->wq_next;
+
+      first = b != NULL ? b->wq_next : NULL;
+      a->wq_next = a->wq_prev = NULL;
+      if (b != NULL)
+        b->wq_next = b->wq_prev = NULL;
+
+      /* Push the pair's root onto a stack, linked through
+         `wq_next'. */
+      a = waitq_meld (a, b);
+      a->wq_next = pairs;
+      pairs = a;
+    }
+
+  while (pairs != NULL)
+    {
+      struct thread *next = pairs->wq_next;
+      pairs->wq_next = NULL;
+      root = waitq_meld (pairs, root);
+      pairs = next;
+    }
+  return root;
+}
+
+/* Detaches non-root node T, along with its subtree, from its
+   parent and siblings. */
+static void
+waitq_cut (struct thread *t) 
+{
+  if (t->wq_prev->wq_child == t)
+    t->wq_prev->wq_child = t->wq_next;
+  else
+    t->wq_prev->wq_next = t->wq_next;
+  if (t->wq_next != NULL)
+    t->wq_next->wq_prev = t->wq_prev;
+  t->wq_next = t->wq_prev = NULL;
+}
+
+/* Adds T, which is about to block, to Q. */
+static void
+waitq_push (struct waitq *q, struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->waitq == NULL);
+
+  t->wq_child = t->wq_next = t->wq_prev = NULL;
+  t->wq_seq = waitq_seq++;
+  t->waitq = q;
+  q->root = waitq_meld (q->root, t);
+}
+
+/* Removes T from its wait queue Q. */
+static void
+waitq_remove (struct waitq *q, struct thread *t) 
+{
+  struct thread *children = t->wq_child;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->waitq == q);
+
+  t->wq_child = NULL;
+  if (t == q->root)
+    q->root = waitq_meld_siblings (children);
+  else
+    {
+      waitq_cut (t);
+      q->root = waitq_meld (q->root, waitq_meld_siblings (children));
+    }
+  t->waitq = NULL;
+}
+
+/* Removes and returns the thread that should be woken first from
+   Q, which must not be empty. */
+static struct thread *
+waitq_pop (struct waitq *q) 
+{
+  struct thread *t = q->root;
+
+  ASSERT (t != NULL);
+  waitq_remove (q, t);
+  return t;
+}
+
+/* Changes the priority of thread T, which is in wait queue Q, to
+   PRIORITY, and moves it to its new place in Q.
+   Called by the scheduler when a waiter's priority changes.
+   Interrupts must be off. */
+void
+waitq_change_priority (struct waitq *q, struct thread *t, int priority) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->waitq == q);
+
+  if (priority > t->priority)
+    {
+      /* T's subtree stays heap-ordered, so just move it up. */
+      t->priority = priority;
+      if (t != q->root)
+        {
+          waitq_cut (t);
+          q->root = waitq_meld (q->root, t);
+        }
+    }
+  else if (priority < t->priority)
+    {
+      waitq_remove (q, t);
+      t->priority = priority;
+      t->wq_child = t->wq_next = t->wq_prev = NULL;
+      t->waitq = q;
+      q->root = waitq_meld (q->root, t);
+    }
+}
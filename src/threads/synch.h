@@ -3,12 +3,24 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+
+/* Queue of threads waiting on a semaphore or condition variable,
+   ordered by priority and, among equal priorities, by arrival. */
+struct waitq
+  {
+    struct thread *root;        /* Root of pairing heap of waiters. */
+  };
+
+void waitq_change_priority (struct waitq *, struct thread *, int priority);
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct waitq waiters;       /* Waiting threads. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -17,23 +29,112 @@ bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
 
+#ifdef LOCKSTAT
+/* Lock profiling statistics, enabled by building with
+   -DLOCKSTAT.  They add what the contention counters in `struct
+   lock' lack: the place each lock was initialized, and time
+   measured in CPU cycles.  Each place in the source that
+   initializes locks has one `struct lockstat', which accumulates
+   the timings of every lock initialized there, e.g. of both IDE
+   channels' locks or of the locks in every open inode.  Keeping
+   them in static storage, instead of in the locks, means that
+   they outlive locks embedded in memory that is later freed. */
+struct lockstat
+  {
+    const char *name;           /* Expression that named the lock. */
+    const char *file;           /* Source file that initialized it. */
+    int line;                   /* Line in FILE. */
+    struct list_elem elem;      /* Element in list of all lockstats. */
+    uint64_t wait_cycles;       /* CPU cycles spent waiting. */
+    uint64_t hold_cycles;       /* CPU cycles spent held. */
+    int max_waiters;            /* Most threads ever waiting at once. */
+  };
+
+/* Number of lockstats printed by lockstat_print(). */
+#define LOCKSTAT_TOP_N 10
+#endif
+
 /* Lock. */
 struct lock 
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct list_elem elem;      /* Element in holder's `locks_held'. */
+    int priority;               /* Highest priority donated by waiters. */
+    bool adaptive;              /* Poll before blocking? */
+
+    /* Contention statistics. */
+    const char *name;           /* Name, if printed at shutdown. */
+    struct list_elem stats_elem; /* Element in list of named locks. */
+    int64_t acquisitions;       /* Number of times acquired. */
+    int64_t contended;          /* Acquisitions that found it held. */
+    int64_t wait_ticks;         /* Timer ticks spent waiting for it. */
+
+#ifdef LOCKSTAT
+    struct lockstat *stat;      /* Profiling statistics, if any. */
+    int waiters;                /* Number of threads waiting. */
+    uint64_t acquire_cycles;    /* Time stamp of last acquisition. */
+#endif
   };
 
+/* Maximum number of locks that a priority donation passes
+   through, e.g. H waits on a lock held by M, which waits on a
+   lock held by L, is a chain of depth 2.  Bounds the time spent
+   with interrupts off in lock_acquire(). */
+#define LOCK_DONATION_DEPTH 8
+
+/* Maximum number of times that lock_acquire() on an adaptive
+   lock yields to a preempted holder before it blocks. */
+#define LOCK_SPIN_CNT 4
+
 void lock_init (struct lock *);
+void lock_init_adaptive (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+void lock_print_stats (void);
+
+#ifdef LOCKSTAT
+void lockstat_attach (struct lock *, struct lockstat *);
+void lockstat_print (void);
+
+/* Attaches a lockstat for the calling line of source code to
+   LOCK, which is described by NAME. */
+#define LOCKSTAT_ATTACH(LOCK, NAME)                                     \
+        do                                                              \
+          {                                                             \
+            static struct lockstat lockstat_ =                          \
+              {.name = NAME, .file = __FILE__, .line = __LINE__};       \
+            lockstat_attach (LOCK, &lockstat_);                         \
+          }                                                             \
+        while (0)
+
+/* Lock initialization functions that also tag the lock with the
+   place it was initialized.  synch.c itself uses the plain
+   functions. */
+#define lock_init(LOCK)                                                 \
+        do                                                              \
+          {                                                             \
+            struct lock *lock_ = (LOCK);                                \
+            (lock_init) (lock_);                                        \
+            LOCKSTAT_ATTACH (lock_, #LOCK);                             \
+          }                                                             \
+        while (0)
+#define lock_init_adaptive(LOCK, NAME)                                  \
+        do                                                              \
+          {                                                             \
+            struct lock *lock_ = (LOCK);                                \
+            (lock_init_adaptive) (lock_, NAME);                         \
+            LOCKSTAT_ATTACH (lock_, #LOCK);                             \
+          }                                                             \
+        while (0)
+#endif
 
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct waitq waiters;       /* Waiting threads. */
   };
 
 void cond_init (struct condition *);
@@ -41,6 +142,57 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.  Any number of readers, or else a single
+   writer, may hold it at once.
+
+   Writers are preferred: once a writer is waiting, new readers
+   queue up behind it, so that a steady stream of readers cannot
+   starve writers.  Writers are admitted one at a time in
+   priority order, and threads waiting for a writer donate their
+   priority to it just as for a lock.  If the lock is initialized
+   with DONATE set, a writer waiting for the readers to drain
+   also donates its priority to them, for up to
+   RWLOCK_READER_SLOTS concurrent readers. */
+#define RWLOCK_READER_SLOTS 8
+
+/* A slot for a thread reading a readers-writer lock. */
+struct rwlock_reader 
+  {
+    struct thread *thread;      /* Reading thread, or null if free. */
+    struct rwlock *rwlock;      /* Owning rwlock. */
+    struct list_elem elem;      /* Element in thread's `rwlocks_read'. */
+  };
+
+struct rwlock 
+  {
+    struct lock writer;         /* Held by the writer, if any. */
+    unsigned readers;           /* Number of readers holding the lock. */
+    unsigned writers_waiting;   /* Writers not yet admitted. */
+    struct waitq read_waiters;  /* Readers waiting for the writers. */
+    struct thread *drainer;     /* Writer waiting for readers to leave. */
+    bool donate;                /* Donate to readers? */
+    struct rwlock_reader reader_slots[RWLOCK_READER_SLOTS]; /* Readers. */
+  };
+
+void rwlock_init (struct rwlock *, bool donate);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
+#ifdef LOCKSTAT
+/* Profiles the lock that admits writers. */
+#define rwlock_init(RW, DONATE)                                         \
+        do                                                              \
+          {                                                             \
+            struct rwlock *rw_ = (RW);                                  \
+            (rwlock_init) (rw_, DONATE);                                \
+            LOCKSTAT_ATTACH (&rw_->writer, #RW);                        \
+          }                                                             \
+        while (0)
+#endif
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -4,7 +4,10 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
+#include "threads/cycles.h"
 #include "threads/flags.h"
+#include "threads/float_custom.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
@@ -20,9 +23,15 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO list per priority level, and bit P of
+   ready_bitmap is set if and only if ready_queues[P] is
+   nonempty, so the highest-priority ready thread is found with a
+   single find-first-set instead of a scan or a sort. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+static int ready_cnt;           /* # of threads in the run queue. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -49,6 +58,15 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static struct thread_acct exited_acct; /* Sum over threads that exited. */
+
+/* Histogram of wakeup-to-run latencies, the CPU cycles from
+   thread_unblock() to the thread being dispatched.  Bucket B
+   counts latencies of at least 2**B and less than 2**(B+1)
+   cycles (bucket 0 also counts latency 0). */
+#define LATENCY_BUCKETS 64
+static long long latency_hist[LATENCY_BUCKETS];
+static uint64_t latency_max;    /* Worst latency seen. */
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
@@ -59,35 +77,33 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* System load average, an estimate of the number of threads
+   ready to run over the past minute.  Used only by the
+   multi-level feedback queue scheduler. */
+static my_float load_avg;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
+static void account_switch (struct thread *cur, struct thread *next);
+static void acct_add (struct thread_acct *, const struct thread_acct *);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_queue_push (struct thread *);
+static struct thread *ready_queue_pop (void);
+static void ready_queue_remove (struct thread *);
+static bool ready_queue_preempts (const struct thread *);
+static void thread_change_priority (struct thread *, int priority);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_update_second (void);
+static void mlfqs_update_priority (struct thread *);
 
-bool
-thread_priority_less (const struct list_elem *a,
-                             const struct list_elem *b,
-                             void *aux)
-                             {
-  struct thread *ta = list_entry (a, struct thread, elem);
-  struct thread *tb = list_entry (b, struct thread, elem);
-  if(ta->priority>tb->priority)
-    return true;
-    return false;
-}
-
-int
-max(int a, int b)
-{
-  return a>=b ? a : b;
-}
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
    general and it is possible in this case only because loader.S
@@ -104,10 +120,14 @@ max(int a, int b)
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
+  ready_bitmap = 0;
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -115,6 +135,8 @@ thread_init (void)
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  if (thread_mlfqs)
+    mlfqs_update_priority (initial_thread);
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -134,14 +156,18 @@ thread_start (void)
   sema_down (&idle_started);
 }
 
-/* Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
+/* Called by the timer at each timer tick.  This function
+   normally runs in an external interrupt context; only ticks
+   accounted to the idle thread by the tickless timer may be
+   reported outside it. */
 void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  bool preempt;
 
   /* Update statistics. */
+  t->acct.run_ticks++;
   if (t == idle_thread)
     idle_ticks++;
 #ifdef USERPROG
@@ -151,9 +177,21 @@ thread_tick (void)
   else
     kernel_ticks++;
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
-    intr_yield_on_return ();
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
+  /* Enforce preemption at the end of the time slice, or as soon
+     as a higher-priority thread is ready.  The idle thread is
+     exempt: it checks for ready threads itself after zeroing
+     pages and before halting, and in tickless mode the timer may
+     account for its ticks outside interrupt context, from
+     timer_idle_exit() called by the idle thread itself. */
+  if (t != idle_thread)
+    {
+      preempt = ++thread_ticks >= TIME_SLICE;
+      if (preempt || ready_queue_preempts (t))
+        intr_yield_on_return ();
+    }
 }
 
 /* Prints thread statistics. */
@@ -164,6 +202,53 @@ thread_print_stats (void)
           idle_ticks, kernel_ticks, user_ticks);
 }
 
+/* Prints one line of CPU accounting for a thread or group of
+   threads. */
+static void
+print_acct (const char *tid, const char *name, const struct thread_acct *a) 
+{
+  printf ("%5s %-16s %10lld %10lld %10lld %14llu\n", tid, name,
+          a->run_ticks, a->voluntary_switches, a->involuntary_switches,
+          a->ready_cycles);
+}
+
+/* Prints the CPU accounting of each thread and of the threads
+   that have exited, followed by the histogram of wakeup-to-run
+   latencies. */
+void
+thread_print_accounting (void) 
+{
+  enum intr_level old_level;
+  struct list_elem *e;
+  long long wakeups = 0;
+  int b;
+
+  printf ("%5s %-16s %10s %10s %10s %14s\n", "tid", "name",
+          "run ticks", "voluntary", "preempted", "ready cycles");
+
+  old_level = intr_disable ();
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      char tid[16];
+
+      snprintf (tid, sizeof tid, "%d", t->tid);
+      print_acct (tid, t->name, &t->acct);
+    }
+  print_acct ("-", "(exited)", &exited_acct);
+  intr_set_level (old_level);
+
+  for (b = 0; b < LATENCY_BUCKETS; b++)
+    wakeups += latency_hist[b];
+  printf ("Wakeup latency: %lld wakeups, at most %llu cycles\n",
+          wakeups, latency_max);
+  for (b = 0; b < LATENCY_BUCKETS; b++)
+    if (latency_hist[b] != 0)
+      printf ("  %20llu+ cycles: %lld\n",
+              b == 0 ? 0 : (unsigned long long) 1 << b, latency_hist[b]);
+}
+
 /* Creates a new kernel thread named NAME with the given initial
    PRIORITY, which executes FUNCTION passing AUX as the argument,
    and adds it to the ready queue.  Returns the thread identifier
@@ -198,8 +283,15 @@ thread_create (const char *name, int priority,
 
   /* Initialize thread. */
   init_thread (t, name, priority);
-  t->priority_origin = priority;
   tid = t->tid = allocate_tid ();
+  if (thread_mlfqs && function != idle)
+    {
+      /* Inherit the parent's niceness and recent CPU time, and
+         ignore the requested priority. */
+      t->nice = thread_current ()->nice;
+      t->recent_cpu = thread_current ()->recent_cpu;
+      mlfqs_update_priority (t);
+    }
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
@@ -260,8 +352,10 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  ready_queue_push (t);
   t->status = THREAD_READY;
+  t->ready_since = rdtsc ();
+  t->woken = true;
   intr_set_level (old_level);
 }
 
@@ -314,6 +408,7 @@ thread_exit (void)
      when it calls thread_schedule_tail(). */
   intr_disable ();
   list_remove (&thread_current()->allelem);
+  acct_add (&exited_acct, &thread_current ()->acct);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -332,10 +427,10 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    {
-      list_push_back (&ready_list, &cur->elem);
-    }
+    ready_queue_push (cur);
   cur->status = THREAD_READY;
+  cur->ready_since = rdtsc ();
+  cur->woken = false;
   schedule ();
   intr_set_level (old_level);
 }
@@ -357,56 +452,204 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
-
+/* Sets the current thread's base priority to NEW_PRIORITY.  The
+   thread keeps running at any higher priority donated to it
+   through the locks it holds.  Yields if the thread no longer
+   has the highest priority. */
 void
 thread_set_priority (int new_priority) 
 {
-  int old_priority = thread_current ()->priority;
-  thread_current ()->priority = new_priority;
-  
-  if(old_priority > new_priority)
-    {
-      thread_yield ();
-    }
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool preempt;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  /* The MLFQS computes priorities on its own. */
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_recompute_priority (cur);
+  preempt = ready_queue_preempts (cur);
+  intr_set_level (old_level);
+
+  if (preempt)
+    thread_yield ();
 }
 
-/* Returns the current thread's priority. */
+/* Returns the current thread's effective priority, including
+   any donations. */
 int
 thread_get_priority (void) 
 {
-  return max(thread_current ()->priority, thread_current ()->priority_origin);
+  return thread_current ()->priority;
+}
+
+/* Raises T's effective priority to PRIORITY, if it is lower, on
+   behalf of a thread waiting for a lock that T holds.
+   Interrupts must be off. */
+void
+thread_donate_priority (struct thread *t, int priority) 
+{
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->priority < priority)
+    thread_change_priority (t, priority);
+}
+
+/* Recomputes T's effective priority as the highest of its base
+   priority, the priorities donated through each lock it holds,
+   and those of the writers waiting for the rwlocks that it reads
+   in a reader slot.  Takes time proportional to the number of
+   locks and reader slots held.  Interrupts must be off. */
+void
+thread_recompute_priority (struct thread *t) 
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->locks_held); e != list_end (&t->locks_held);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      if (lock->priority > priority)
+        priority = lock->priority;
+    }
+  for (e = list_begin (&t->rwlocks_read); e != list_end (&t->rwlocks_read);
+       e = list_next (e))
+    {
+      struct rwlock_reader *r = list_entry (e, struct rwlock_reader, elem);
+      struct thread *drainer = r->rwlock->drainer;
+      if (drainer != NULL && drainer->priority > priority)
+        priority = drainer->priority;
+    }
+  thread_change_priority (t, priority);
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes
+   its priority, yielding if it no longer has the highest
+   priority. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_set_nice (int nice) 
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool preempt;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur);
+  preempt = ready_queue_preempts (cur);
+  intr_set_level (old_level);
+
+  if (preempt)
+    thread_yield ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load = to_int_rnear (mult_int (load_avg, 100));
+  intr_set_level (old_level);
+  return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int recent = to_int_rnear (mult_int (thread_current ()->recent_cpu, 100));
+  intr_set_level (old_level);
+  return recent;
+}
+
+/* Does the multi-level feedback queue scheduler's per-tick work
+   on behalf of T, the running thread.
+
+   From one tick to the next only T's recent_cpu changes, so only
+   T's priority needs to be recomputed every fourth tick.  The
+   load average, and with it every other thread's recent_cpu and
+   priority, changes only once per second. */
+static void
+mlfqs_tick (struct thread *t) 
+{
+  int64_t now = timer_ticks ();
+
+  if (t != idle_thread)
+    t->recent_cpu = add_int (t->recent_cpu, 1);
+
+  if (now % TIMER_FREQ == 0)
+    mlfqs_update_second ();
+  else if (now % TIME_SLICE == 0 && t != idle_thread)
+    mlfqs_update_priority (t);
+}
+
+/* Updates the load average, then decays every thread's
+   recent_cpu and recomputes its priority.  Threads whose
+   recent_cpu and nice are both zero are skipped, since neither
+   value can change for them. */
+static void
+mlfqs_update_second (void) 
+{
+  struct thread *cur = running_thread ();
+  int ready_threads = ready_cnt + (cur != idle_thread ? 1 : 0);
+  my_float twice_load, decay;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  load_avg = add (div_int (mult_int (load_avg, 59), 60),
+                  div_int (to_my_float (ready_threads), 60));
+
+  twice_load = mult_int (load_avg, 2);
+  decay = div (twice_load, add_int (twice_load, 1));
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      if (t == idle_thread || (t->recent_cpu == 0 && t->nice == 0))
+        continue;
+
+      t->recent_cpu = add_int (mult (decay, t->recent_cpu), t->nice);
+      mlfqs_update_priority (t);
+    }
+}
+
+/* Recomputes T's priority from its recent_cpu and nice values:
+   PRI_MAX - (recent_cpu / 4) - (nice * 2), clamped to the valid
+   range. */
+static void
+mlfqs_update_priority (struct thread *t) 
+{
+  my_float p = sub_int (sub (to_my_float (PRI_MAX),
+                             div_int (t->recent_cpu, 4)),
+                        t->nice * 2);
+  int priority = to_int_rzero (p);
+
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  thread_change_priority (t, priority);
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -431,6 +674,19 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Zero pages for palloc_get_page(PAL_ZERO) while there is
+         nothing else to do. */
+      intr_enable ();
+      palloc_idle ();
+      intr_disable ();
+
+      /* A thread that became ready while we were zeroing pages
+         did not preempt us (see thread_tick()), so run it now
+         instead of halting until the next interrupt. */
+      if (ready_bitmap != 0)
+        continue;
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -444,6 +700,7 @@ idle (void *idle_started_ UNUSED)
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
          7.11.1 "HLT Instruction". */
       asm volatile ("sti; hlt" : : : "memory");
+      timer_idle_exit ();
     }
 }
 
@@ -494,7 +751,12 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  list_init (&t->locks_held);
+  list_init (&t->rwlocks_read);
+#ifdef VM
+  list_init (&t->mappings);
+#endif
   t->magic = THREAD_MAGIC;
 
   old_level = intr_disable ();
@@ -524,16 +786,107 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  struct list_elem *e;
-  if (list_empty (&ready_list))
+  if (ready_bitmap == 0)
+    return idle_thread;
+  else
+    return ready_queue_pop ();
+}
+
+/* Returns the index of the most significant set bit in BITS,
+   which must be nonzero. */
+static inline int
+highest_bit (uint64_t bits)
+{
+  uint32_t hi = bits >> 32;
+
+  ASSERT (bits != 0);
+  if (hi != 0)
+    return 63 - __builtin_clz (hi);
+  else
+    return 31 - __builtin_clz ((uint32_t) bits);
+}
+
+/* Changes T's priority to PRIORITY, moving T to the matching run
+   queue if it is ready to run, or to its new place in the wait
+   queue it is in.  A thread joins a wait queue just before it
+   blocks, so it may still be running, e.g. in cond_wait() while
+   it releases the lock.  Interrupts must be off. */
+static void
+thread_change_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  if (t->priority == priority)
+    return;
+
+  if (t->status == THREAD_READY)
     {
-      return idle_thread;
+      ready_queue_remove (t);
+      t->priority = priority;
+      ready_queue_push (t);
     }
+  else if (t->waitq != NULL)
+    waitq_change_priority (t->waitq, t, priority);
   else
-  {
-    list_sort(&ready_list, thread_priority_less, NULL);
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
-  }
+    t->priority = priority;
+}
+
+/* Appends T to the run queue for its priority.  Threads of equal
+   priority are therefore run in FIFO (round-robin) order.
+   Interrupts must be off. */
+static void
+ready_queue_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_bitmap |= (uint64_t) 1 << t->priority;
+  ready_cnt++;
+}
+
+/* Removes and returns the thread at the head of the highest
+   nonempty run queue.  The run queue must not be empty.
+   Interrupts must be off. */
+static struct thread *
+ready_queue_pop (void)
+{
+  int priority = highest_bit (ready_bitmap);
+  struct list *queue = &ready_queues[priority];
+  struct thread *t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  if (list_empty (queue))
+    ready_bitmap &= ~((uint64_t) 1 << priority);
+  ready_cnt--;
+  return t;
+}
+
+/* Removes ready thread T from the run queue.  Interrupts must be
+   off. */
+static void
+ready_queue_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_bitmap &= ~((uint64_t) 1 << t->priority);
+  ready_cnt--;
+}
+
+/* Returns true if some ready thread has a higher priority than
+   T.  Interrupts must be off. */
+static bool
+ready_queue_preempts (const struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  return ready_bitmap != 0 && highest_bit (ready_bitmap) > t->priority;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -602,10 +955,50 @@ schedule (void)
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      account_switch (cur, next);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
+/* Charges a switch from CUR to NEXT to CUR's switch counts,
+   and NEXT's wait to its time spent ready and, if it was woken
+   up, to the latency histogram.  Interrupts must be off. */
+static void
+account_switch (struct thread *cur, struct thread *next) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (cur->status == THREAD_BLOCKED)
+    cur->acct.voluntary_switches++;
+  else if (cur->status == THREAD_READY)
+    cur->acct.involuntary_switches++;
+
+  if (next != idle_thread)
+    {
+      uint64_t latency = rdtsc () - next->ready_since;
+
+      next->acct.ready_cycles += latency;
+      if (next->woken)
+        {
+          latency_hist[latency != 0 ? highest_bit (latency) : 0]++;
+          if (latency > latency_max)
+            latency_max = latency;
+        }
+    }
+}
+
+/* Adds the accounting in B to A. */
+static void
+acct_add (struct thread_acct *a, const struct thread_acct *b) 
+{
+  a->run_ticks += b->run_ticks;
+  a->voluntary_switches += b->voluntary_switches;
+  a->involuntary_switches += b->involuntary_switches;
+  a->ready_cycles += b->ready_cycles;
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) 
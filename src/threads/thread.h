@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/float_custom.h"
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -24,6 +25,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the multi-level feedback queue scheduler. */
+#define NICE_MIN -20                    /* Nicest to other threads. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -74,12 +80,21 @@ typedef int tid_t;
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+/* CPU accounting for a thread, or for a group of threads. */
+struct thread_acct
+  {
+    int64_t run_ticks;                  /* Timer ticks spent running. */
+    int64_t voluntary_switches;         /* Switches away to block. */
+    int64_t involuntary_switches;       /* Switches away while runnable. */
+    uint64_t ready_cycles;              /* CPU cycles spent ready to run. */
+  };
+
+/* The `elem' member is an element in the run queue (thread.c).
+   A thread blocked on a semaphore or condition variable is
+   instead linked into that object's wait queue (synch.c) through
+   its `wq_*' members.  Both uses are mutually exclusive: only a
+   thread in the ready state is on the run queue, whereas only a
+   thread in the blocked state is in a wait queue. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -87,18 +102,43 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
-    int priority_origin;                
-    int64_t endtime;
-    struct list donation_list;
+    int priority;                       /* Effective priority. */
+    int base_priority;                  /* Priority before donations. */
+    int nice;                           /* Niceness, for the MLFQS. */
+    my_float recent_cpu;                /* Recent CPU time, for the MLFQS. */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct thread_acct acct;            /* CPU accounting. */
+    uint64_t ready_since;               /* Time stamp of becoming ready. */
+    bool woken;                         /* Made ready by thread_unblock()? */
+
+    /* Owned by devices/timer.c. */
+    int64_t endtime;                    /* Tick at which to wake up. */
+    struct thread *sleep_left;          /* Left child in sleep heap. */
+    struct thread *sleep_right;         /* Right child in sleep heap. */
+    int sleep_rank;                     /* Rank in sleep heap. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct list locks_held;             /* Locks held, for donation. */
+    struct list rwlocks_read;           /* Reader slots held, for donation. */
+    struct lock *waiting_lock;          /* Lock being waited for. */
+    struct waitq *waitq;                /* Wait queue blocked in, if any. */
+
+    /* Owned by synch.c. */
+    struct thread *wq_child;            /* Leftmost child in wait queue. */
+    struct thread *wq_next;             /* Right sibling in wait queue. */
+    struct thread *wq_prev;             /* Left sibling or parent. */
+    int64_t wq_seq;                     /* Arrival order in wait queue. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+#ifdef VM
+    struct hash *pages;                 /* Supplemental page table. */
+    struct file *exec_file;             /* Executable, kept open. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping identifier. */
+#endif
 #endif
 
     /* Owned by thread.c. */
@@ -115,6 +155,7 @@ void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+void thread_print_accounting (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -135,6 +176,8 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_donate_priority (struct thread *, int priority);
+void thread_recompute_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
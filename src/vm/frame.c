@@ -0,0 +1,328 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+/* Frame table.
+
+   Every page of the user pool that holds a user page has a
+   `struct frame' in the frame table.  When the user pool runs
+   out, frame_alloc() evicts a page to free up its frame, chosen
+   by the clock algorithm: a "hand" sweeps around the table,
+   clearing each page's accessed bit and evicting the first page
+   whose bit was already clear, that is, one that has not been
+   used for a full turn of the hand.
+
+   A page that must go to swap takes with it up to SWAP_CLUSTER
+   - 1 other modified, unaccessed pages of the same process that
+   lie a little further along the hand's path, so that they are
+   written together in one request and the frames freed up serve
+   the next few allocations without another eviction.
+
+   A frame shared among processes belongs to a share instead of
+   a page (see vm/share.c).  The hand treats it like any other
+   frame, except that it was accessed if any of its pages was
+   accessed, and evicting it just unmaps it from all of them.
+
+   A frame's `page' and `share' members are protected by
+   frame_lock.  A page being loaded, evicted, or destroyed is
+   locked by its own `lock', and a share by its `lock', so the
+   hand skips pages and shares whose lock it cannot get at
+   once. */
+
+/* How many frames past the victim to look for pages to evict
+   along with it. */
+#define CLUSTER_SCAN (4 * SWAP_CLUSTER)
+
+/* All frames, in clock order. */
+static struct list frames;
+
+/* Next frame for the clock hand to examine, or the end of
+   `frames' to wrap around. */
+static struct list_elem *hand;
+
+/* Number of frames. */
+static size_t frame_cnt;
+
+/* Protects the variables above and each frame's `page'. */
+static struct lock frame_lock;
+
+/* Cache of `struct frame's. */
+static struct kmem_cache frame_cache;
+
+/* Statistics. */
+static long long evict_cnt;     /* Pages evicted. */
+
+static struct frame *frame_evict (struct page *);
+static struct frame *frame_insert (struct page *, void *kpage);
+
+/* Initializes the frame table. */
+void
+frame_init (void) 
+{
+  list_init (&frames);
+  hand = list_end (&frames);
+  lock_init (&frame_lock);
+  kmem_cache_init (&frame_cache, "frame", sizeof (struct frame), NULL);
+}
+
+/* Obtains a frame for page P, whose lock must be held, and
+   returns it, evicting another page if necessary.  If ZERO is
+   true, the frame is filled with zeros.  Returns a null pointer
+   if no frame can be obtained. */
+struct frame *
+frame_alloc (struct page *p, bool zero) 
+{
+  struct frame *f;
+  void *kpage;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  kpage = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+  if (kpage == NULL) 
+    {
+      f = frame_evict (p);
+      if (f != NULL && zero)
+        memset (f->kpage, 0, PGSIZE);
+      return f;
+    }
+  return frame_insert (p, kpage);
+}
+
+/* Obtains a free frame for page P, whose lock must be held, and
+   returns it.  Unlike frame_alloc(), never evicts a page:
+   returns a null pointer if no frame is free. */
+struct frame *
+frame_try_alloc (struct page *p) 
+{
+  void *kpage;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  kpage = palloc_get_page (PAL_USER);
+  return kpage != NULL ? frame_insert (p, kpage) : NULL;
+}
+
+/* Adds a frame for KPAGE, a page of the user pool, holding page
+   P to the frame table, and returns it.  Frees KPAGE and returns
+   a null pointer if memory is not available. */
+static struct frame *
+frame_insert (struct page *p, void *kpage) 
+{
+  struct frame *f;
+
+  f = kmem_cache_alloc (&frame_cache);
+  if (f == NULL) 
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  f->kpage = kpage;
+  f->page = p;
+  f->share = NULL;
+
+  /* Put the new frame just behind the hand, so that it is the
+     last to be examined. */
+  lock_acquire (&frame_lock);
+  list_insert (hand, &f->elem);
+  frame_cnt++;
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Hands frame F, which was allocated for a page whose lock is
+   held, over to share S, whose lock must also be held. */
+void
+frame_set_share (struct frame *f, struct share *s) 
+{
+  ASSERT (lock_held_by_current_thread (&f->page->lock));
+
+  lock_acquire (&frame_lock);
+  f->page = NULL;
+  f->share = s;
+  lock_release (&frame_lock);
+}
+
+/* Removes frame F from the frame table and frees it.  The lock
+   of F's page, or of its share, must be held. */
+void
+frame_free (struct frame *f) 
+{
+  ASSERT (f->share != NULL || lock_held_by_current_thread (&f->page->lock));
+
+  lock_acquire (&frame_lock);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  frame_cnt--;
+  lock_release (&frame_lock);
+
+  palloc_free_page (f->kpage);
+  kmem_cache_free (&frame_cache, f);
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void) 
+{
+  printf ("Frames: %zu in use, %lld pages evicted\n", frame_cnt, evict_cnt);
+}
+
+/* Tries to acquire LOCK without waiting.  Unlike
+   lock_try_acquire(), allows LOCK to be held by the current
+   thread already, in which case it fails. */
+static bool
+try_lock (struct lock *lock) 
+{
+  return !lock_held_by_current_thread (lock) && lock_try_acquire (lock);
+}
+
+/* Advances the clock hand and returns the frame it passes. */
+static struct frame *
+clock_next (void) 
+{
+  struct frame *f;
+
+  if (hand == list_end (&frames))
+    hand = list_begin (&frames);
+  f = list_entry (hand, struct frame, elem);
+  hand = list_next (hand);
+  return f;
+}
+
+/* Looks through the frames after VICTIM_FRAME, whose page is
+   locked, for up to MAX other pages to evict along with it: pages
+   of the same process that must be written to swap and have not
+   been accessed recently.  Memory-mapped pages go back to their
+   files, not to swap, so they are left out.  Locks each page
+   found, stores it in PAGES, and returns the number found.
+   frame_lock must be held. */
+static size_t
+gather_cluster (struct frame *victim_frame, struct page *pages[], size_t max) 
+{
+  struct page *victim = victim_frame->page;
+  struct list_elem *e = &victim_frame->elem;
+  size_t cnt = 0;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  for (i = 0; i < CLUSTER_SCAN && i + 1 < frame_cnt && cnt < max; i++) 
+    {
+      struct page *q;
+
+      e = list_next (e);
+      if (e == list_end (&frames))
+        e = list_begin (&frames);
+      q = list_entry (e, struct frame, elem)->page;
+
+      if (q == NULL
+          || q->pagedir != victim->pagedir
+          || q->type == PAGE_MMAP
+          || pagedir_is_accessed (q->pagedir, q->upage)
+          || (q->type != PAGE_SWAP && !pagedir_is_dirty (q->pagedir, q->upage))
+          || !try_lock (&q->lock))
+        continue;
+      pages[cnt++] = q;
+    }
+  return cnt;
+}
+
+/* Evicts a page from its frame, gives the frame to page P, whose
+   lock must be held, and returns the frame.  Returns a null
+   pointer if no page can be evicted. */
+static struct frame *
+frame_evict (struct page *p) 
+{
+  size_t i;
+
+  lock_acquire (&frame_lock);
+
+  /* Two full turns of the hand are enough to find a page that
+     has not been accessed, unless every page is locked or cannot
+     be written to swap. */
+  for (i = 0; i < 2 * frame_cnt; i++) 
+    {
+      struct frame *f = clock_next ();
+      struct page *victim = f->page;
+      struct page *victims[SWAP_CLUSTER];
+      struct frame *frames[SWAP_CLUSTER];
+      size_t cnt, j;
+
+      if (f->share != NULL) 
+        {
+          /* A shared frame is never written out, so it can be
+             taken over without releasing frame_lock. */
+          if (share_try_evict (f->share)) 
+            {
+              f->share = NULL;
+              f->page = p;
+              evict_cnt++;
+              lock_release (&frame_lock);
+              return f;
+            }
+          continue;
+        }
+
+      if (!try_lock (&victim->lock))
+        continue;
+      if (pagedir_is_accessed (victim->pagedir, victim->upage)) 
+        {
+          pagedir_set_accessed (victim->pagedir, victim->upage, false);
+          lock_release (&victim->lock);
+          continue;
+        }
+
+      /* Take the frame for P, then write out its page, and any
+         others that go along with it, without holding
+         frame_lock. */
+      victims[0] = victim;
+      cnt = 1 + gather_cluster (f, victims + 1, SWAP_CLUSTER - 1);
+      for (j = 1; j < cnt; j++)
+        frames[j] = victims[j]->frame;
+      f->page = p;
+      lock_release (&frame_lock);
+
+      /* If there is no run of free slots for the whole cluster,
+         try the victim alone. */
+      if (!page_out (victims, cnt) && cnt > 1) 
+        {
+          for (j = 1; j < cnt; j++)
+            lock_release (&victims[j]->lock);
+          cnt = 1;
+          if (!page_out (victims, 1))
+            cnt = 0;
+        }
+
+      if (cnt > 0) 
+        {
+          for (j = 1; j < cnt; j++) 
+            {
+              frame_free (frames[j]);
+              lock_release (&victims[j]->lock);
+            }
+          lock_release (&victim->lock);
+          lock_acquire (&frame_lock);
+          evict_cnt += cnt;
+          lock_release (&frame_lock);
+          return f;
+        }
+
+      /* The page could not be written out, so give the frame back
+         and keep looking. */
+      lock_acquire (&frame_lock);
+      f->page = victim;
+      lock_release (&victim->lock);
+    }
+
+  lock_release (&frame_lock);
+  return NULL;
+}
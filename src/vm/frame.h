@@ -0,0 +1,26 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+
+struct page;
+struct share;
+
+/* A frame: a page of the user pool that holds a user page. */
+struct frame
+  {
+    void *kpage;                /* Kernel virtual address. */
+    struct page *page;          /* Page held, or null if shared. */
+    struct share *share;        /* Share holding it, or null. */
+    struct list_elem elem;      /* Element in frame table. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, bool zero);
+struct frame *frame_try_alloc (struct page *);
+void frame_set_share (struct frame *, struct share *);
+void frame_free (struct frame *);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
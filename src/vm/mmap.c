@@ -0,0 +1,135 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.
+
+   A mapping makes the pages of a file appear at consecutive user
+   virtual addresses.  Each page is a PAGE_MMAP page in the
+   supplemental page table, read from the file when first touched,
+   like a page of an executable.  When a PAGE_MMAP page leaves
+   memory, whether evicted, unmapped, or discarded when the
+   process exits, it is written back to the file if and only if
+   the page directory shows it dirty, and it never goes to swap.
+   The process thus reads and writes the file's data in place,
+   without copying it through a buffer of its own. */
+
+/* A mapping. */
+struct mapping
+  {
+    mapid_t id;                 /* Mapping identifier. */
+    struct file *file;          /* File, reopened for the mapping. */
+    uint8_t *base;              /* First user page. */
+    size_t page_cnt;            /* Number of pages. */
+    struct list_elem elem;      /* Element in thread's `mappings'. */
+  };
+
+static void unmap (struct mapping *, size_t page_cnt);
+
+/* Maps FILE, which must not be empty, at ADDR, which must be a
+   nonzero page-aligned user virtual address, in the current
+   process, and returns the mapping's identifier.  The mapping
+   stays in place even if FILE is closed.  Returns MAP_FAILED if
+   the mapping would overlap pages already in use or extend
+   beyond user virtual memory, or if memory is not available. */
+mapid_t
+mmap_create (struct file *file, void *addr) 
+{
+  struct thread *t = thread_current ();
+  struct mapping *m;
+  off_t length;
+  size_t i;
+
+  length = file_length (file);
+  if (length == 0 || addr == NULL || pg_ofs (addr) != 0
+      || (uintptr_t) addr + length < (uintptr_t) addr
+      || !is_user_vaddr ((uint8_t *) addr + length - 1))
+    return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL) 
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->base = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+
+  for (i = 0; i < m->page_cnt; i++) 
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!page_add_mmap (m->base + ofs, m->file, ofs, read_bytes)) 
+        {
+          unmap (m, i);
+          return MAP_FAILED;
+        }
+    }
+
+  m->id = t->next_mapid++;
+  list_push_back (&t->mappings, &m->elem);
+  return m->id;
+}
+
+/* Removes the current process's mapping MAPPING, writing its
+   modified pages back to the file.  Returns false if there is no
+   such mapping. */
+bool
+mmap_destroy (mapid_t mapping) 
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->mappings); e != list_end (&t->mappings);
+       e = list_next (e)) 
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == mapping) 
+        {
+          list_remove (&m->elem);
+          unmap (m, m->page_cnt);
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Removes all of the current process's mappings, writing their
+   modified pages back to their files. */
+void
+mmap_destroy_all (void) 
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->mappings)) 
+    {
+      struct mapping *m = list_entry (list_pop_front (&t->mappings),
+                                      struct mapping, elem);
+      unmap (m, m->page_cnt);
+    }
+}
+
+/* Removes the first PAGE_CNT pages of mapping M from the current
+   process, writing back those that were modified, then closes
+   M's file and frees M. */
+static void
+unmap (struct mapping *m, size_t page_cnt) 
+{
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    page_remove (m->base + i * PGSIZE);
+  file_close (m->file);
+  free (m);
+}
@@ -0,0 +1,498 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+/* Demand paging.
+
+   load() no longer reads an executable into memory.  Instead, it
+   enters each page of each segment into the process's
+   supplemental page table, and leaves the page unmapped in the
+   page directory.  The first access to the page faults, and the
+   page fault handler calls page_in(), which allocates a frame,
+   fills it from the file or with zeros, and maps it.  Pages the
+   process never touches are never read or allocated.
+
+   When the user pool is exhausted, frame_alloc() evicts another
+   page with page_out().  (Pages of executables are shared among
+   processes instead; see vm/share.c.)  A page that has been
+   modified goes to swap, or back to its file if it is part of a
+   memory-mapped file (see vm/mmap.c); any other page is simply
+   dropped, to be loaded again from its file or as zeros.
+
+   Pages evicted together are written to adjacent swap slots in
+   order of address, so a process's neighboring pages tend to be
+   neighbors in swap too.  page_in() takes advantage of this by
+   reading, along with the page that faulted, the pages of the
+   same process in the slots on either side, in a single
+   request. */
+
+/* Cache of `struct page's. */
+static struct kmem_cache page_cache;
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void) 
+{
+  kmem_cache_init (&page_cache, "page", sizeof (struct page), NULL);
+}
+
+/* Returns a hash value for page P. */
+static unsigned
+page_hash (const struct hash_elem *p_, void *aux UNUSED) 
+{
+  const struct page *p = hash_entry (p_, struct page, hash_elem);
+  return hash_int (pg_no (p->upage));
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED) 
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+
+  return a->upage < b->upage;
+}
+
+/* Creates and returns a new, empty supplemental page table, or
+   returns a null pointer if memory is not available. */
+struct hash *
+page_table_create (void) 
+{
+  struct hash *pages = malloc (sizeof *pages);
+  if (pages != NULL && !hash_init (pages, page_hash, page_less, NULL)) 
+    {
+      free (pages);
+      pages = NULL;
+    }
+  return pages;
+}
+
+/* Writes memory-mapped page P, which must be resident and
+   unmapped, back to its file if it has been modified. */
+static void
+write_back (struct page *p) 
+{
+  ASSERT (p->type == PAGE_MMAP);
+  ASSERT (p->frame != NULL);
+
+  if (pagedir_is_dirty (p->pagedir, p->upage)) 
+    {
+      file_write_at (p->file, p->frame->kpage, p->read_bytes, p->file_ofs);
+      pagedir_set_dirty (p->pagedir, p->upage, false);
+    }
+}
+
+/* Frees the page containing hash element P_, along with its
+   frame or swap slot, first writing it back to its file if it is
+   a modified memory-mapped page. */
+static void
+page_destroy (struct hash_elem *p_, void *aux UNUSED) 
+{
+  struct page *p = hash_entry (p_, struct page, hash_elem);
+
+  /* Wait for any eviction in progress. */
+  lock_acquire (&p->lock);
+  if (p->share != NULL)
+    share_remove (p);
+  else if (p->frame != NULL) 
+    {
+      pagedir_clear_page (p->pagedir, p->upage);
+      if (p->type == PAGE_MMAP)
+        write_back (p);
+      frame_free (p->frame);
+    }
+  else if (p->type == PAGE_SWAP)
+    swap_free (p->swap_slot);
+  lock_release (&p->lock);
+
+  kmem_cache_free (&page_cache, p);
+}
+
+/* Destroys supplemental page table PAGES, which may be null,
+   freeing its pages' frames and swap slots.  The page directory
+   that the pages are mapped in must not be active, and must not
+   be destroyed before PAGES. */
+void
+page_table_destroy (struct hash *pages) 
+{
+  if (pages != NULL) 
+    {
+      hash_destroy (pages, page_destroy);
+      free (pages);
+    }
+}
+
+/* Adds a page at UPAGE, of TYPE, to the current process's
+   supplemental page table, and returns it.  Returns a null
+   pointer if UPAGE is already in the table or if memory is not
+   available. */
+static struct page *
+page_add (void *upage, enum page_type type, bool writable) 
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (t->pages != NULL);
+
+  p = kmem_cache_alloc (&page_cache);
+  if (p == NULL)
+    return NULL;
+
+  p->upage = upage;
+  p->pagedir = t->pagedir;
+  p->type = type;
+  p->writable = writable;
+  lock_init (&p->lock);
+  p->frame = NULL;
+  p->file = NULL;
+  p->file_ofs = 0;
+  p->read_bytes = 0;
+  p->swap_slot = 0;
+  p->share = NULL;
+  if (hash_insert (t->pages, &p->hash_elem) != NULL) 
+    {
+      kmem_cache_free (&page_cache, p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Adds a page at UPAGE to the current process's address space,
+   to be filled with zeros when first touched.  The process may
+   write the page if WRITABLE is true.  Returns true if
+   successful, false if UPAGE is already in use or if memory is
+   not available. */
+bool
+page_add_zero (void *upage, bool writable) 
+{
+  return page_add (upage, PAGE_ZERO, writable) != NULL;
+}
+
+/* Adds a page at UPAGE to the current process's address space,
+   to be filled when first touched by reading READ_BYTES bytes
+   from FILE starting at offset OFS, followed by zeros.  The
+   process may write the page if WRITABLE is true.  The page
+   shares its frame with other processes' pages that read the same
+   data, until it is written.  FILE must stay open, and must not
+   be written, as long as the page exists.  Returns true if
+   successful, false if UPAGE is already in use or if memory is
+   not available. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs, size_t read_bytes,
+               bool writable) 
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = page_add (upage, PAGE_FILE, writable);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+
+  /* If there is no memory for sharing, the page just gets a frame
+     of its own. */
+  share_add (p);
+  return true;
+}
+
+/* Adds a writable page at UPAGE to the current process's address
+   space that maps READ_BYTES bytes of FILE starting at offset
+   OFS, followed by zeros.  The page is read when first touched,
+   and whenever it leaves memory, it is written back to FILE if
+   it has been modified.  FILE must stay open as long as the page
+   exists.  Returns true if successful, false if UPAGE is already
+   in use or if memory is not available. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs, size_t read_bytes) 
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = page_add (upage, PAGE_MMAP, true);
+  if (p == NULL)
+    return false;
+  p->file = file;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  return true;
+}
+
+/* Removes the page at UPAGE, which must exist, from the current
+   process's address space, as page_destroy() does. */
+void
+page_remove (void *upage) 
+{
+  struct page *p = page_lookup (upage);
+
+  ASSERT (p != NULL);
+  hash_delete (thread_current ()->pages, &p->hash_elem);
+  page_destroy (&p->hash_elem, NULL);
+}
+
+/* Returns the page that contains user virtual address ADDR in
+   the current process's supplemental page table, or a null
+   pointer if there is none. */
+struct page *
+page_lookup (const void *addr) 
+{
+  struct thread *t = thread_current ();
+  struct hash_elem *e;
+  struct page p;
+
+  if (t->pages == NULL || !is_user_vaddr (addr))
+    return NULL;
+
+  p.upage = pg_round_down (addr);
+  e = hash_find (t->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Reads the contents of PAGE_FILE or PAGE_MMAP page P into
+   KPAGE: READ_BYTES bytes from the file, followed by zeros.
+   Returns true if successful, false if the file is too short. */
+bool
+page_read (struct page *p, void *kpage) 
+{
+  ASSERT (p->type == PAGE_FILE || p->type == PAGE_MMAP);
+
+  if (file_read_at (p->file, kpage, p->read_bytes, p->file_ofs)
+      != (off_t) p->read_bytes)
+    return false;
+  memset ((uint8_t *) kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+  return true;
+}
+
+/* Returns the page K pages away from P, which must be in the
+   current process, if it is in swap K slots away from P, and if
+   it can be locked and given a frame without waiting or evicting
+   anything.  The page is returned locked, with its frame in its
+   `frame' member but not yet mapped.  Otherwise, returns a null
+   pointer. */
+static struct page *
+claim_neighbor (struct page *p, int k) 
+{
+  struct page *q = page_lookup ((uint8_t *) p->upage + k * PGSIZE);
+
+  if (q == NULL || !lock_try_acquire (&q->lock))
+    return NULL;
+  if (q->frame == NULL && q->type == PAGE_SWAP
+      && q->swap_slot == p->swap_slot + k
+      && (q->frame = frame_try_alloc (q)) != NULL)
+    return q;
+  lock_release (&q->lock);
+  return NULL;
+}
+
+/* Reads page P, which is in swap, into frame F.  Also reads, in
+   the same request, up to SWAP_CLUSTER - 1 of the pages around P
+   that claim_neighbor() can claim, and maps them.  P's lock must
+   be held.  P is left to the caller to map, and its swap slot to
+   free. */
+static void
+swap_in_around (struct page *p, struct frame *f) 
+{
+  struct page *ahead[SWAP_CLUSTER], *behind[SWAP_CLUSTER];
+  struct page *run[SWAP_CLUSTER];
+  void *kpages[SWAP_CLUSTER];
+  size_t before = 0, after = 0;
+  size_t cnt = 0;
+  size_t i;
+
+  /* Claim pages after P, then before it, stopping in each
+     direction at the first gap. */
+  while (1 + before + after < SWAP_CLUSTER
+         && (ahead[after] = claim_neighbor (p, (int) after + 1)) != NULL)
+    after++;
+  while (1 + before + after < SWAP_CLUSTER
+         && (behind[before] = claim_neighbor (p, -(int) before - 1)) != NULL)
+    before++;
+
+  /* Put the run in swap slot order. */
+  for (i = before; i-- > 0; )
+    run[cnt++] = behind[i];
+  run[cnt++] = p;
+  for (i = 0; i < after; i++)
+    run[cnt++] = ahead[i];
+  for (i = 0; i < cnt; i++)
+    kpages[i] = run[i] == p ? f->kpage : run[i]->frame->kpage;
+
+  swap_in (p->swap_slot - before, kpages, cnt);
+
+  /* Map the neighbors.  A neighbor that cannot be mapped keeps
+     its swap slot. */
+  for (i = 0; i < cnt; i++) 
+    {
+      struct page *q = run[i];
+      if (q == p)
+        continue;
+      if (pagedir_set_page (q->pagedir, q->upage, q->frame->kpage,
+                            q->writable))
+        swap_free (q->swap_slot);
+      else 
+        {
+          frame_free (q->frame);
+          q->frame = NULL;
+        }
+      lock_release (&q->lock);
+    }
+}
+
+/* Loads the page that contains FAULT_ADDR, which must not be
+   mapped, into a frame and maps it in the current process's page
+   directory.  Returns true if successful, false if FAULT_ADDR is
+   not in the process's address space or if no frame can be
+   obtained. */
+bool
+page_in (void *fault_addr) 
+{
+  struct page *p = page_lookup (fault_addr);
+  struct frame *f;
+  bool success = false;
+
+  if (p == NULL)
+    return false;
+
+  lock_acquire (&p->lock);
+  ASSERT (p->frame == NULL);
+
+  if (p->share != NULL) 
+    {
+      success = share_in (p);
+      goto done;
+    }
+
+  f = frame_alloc (p, p->type == PAGE_ZERO);
+  if (f == NULL)
+    goto done;
+
+  if (p->type == PAGE_FILE || p->type == PAGE_MMAP) 
+    {
+      if (!page_read (p, f->kpage))
+        {
+          frame_free (f);
+          goto done;
+        }
+    }
+  else if (p->type == PAGE_SWAP)
+    swap_in_around (p, f);
+
+  if (!pagedir_set_page (p->pagedir, p->upage, f->kpage, p->writable)) 
+    {
+      frame_free (f);
+      goto done;
+    }
+  if (p->type == PAGE_SWAP)
+    swap_free (p->swap_slot);
+  p->frame = f;
+  success = true;
+
+ done:
+  lock_release (&p->lock);
+  return success;
+}
+
+/* Handles a write to the page that contains FAULT_ADDR, which is
+   mapped read-only, by giving the page a private copy of its
+   shared frame, if it is a writable page in a share.  Returns
+   true if successful, false if the page is not writable, is not
+   shared, or cannot be copied. */
+bool
+page_unshare (void *fault_addr) 
+{
+  struct page *p = page_lookup (fault_addr);
+  bool success = false;
+
+  if (p == NULL || !p->writable)
+    return false;
+
+  lock_acquire (&p->lock);
+  if (p->share != NULL)
+    success = share_break (p);
+  lock_release (&p->lock);
+  return success;
+}
+
+/* Evicts the CNT pages in PAGES, where CNT is at most
+   SWAP_CLUSTER, from their frames: unmaps them and writes those
+   that have been modified to adjacent swap slots, in order of
+   address, in a single request.  Memory-mapped pages are written
+   back to their files instead, one at a time, if they have been
+   modified.  The pages' locks must be held.  Returns false,
+   leaving every page mapped, if they must be written to swap but
+   there is no run of free swap slots long enough. */
+bool
+page_out (struct page *pages[], size_t cnt) 
+{
+  struct page *dirty[SWAP_CLUSTER];
+  void *kpages[SWAP_CLUSTER];
+  size_t dirty_cnt = 0;
+  size_t i, j;
+
+  ASSERT (cnt <= SWAP_CLUSTER);
+
+  for (i = 0; i < cnt; i++) 
+    {
+      struct page *p = pages[i];
+
+      ASSERT (lock_held_by_current_thread (&p->lock));
+      ASSERT (p->frame != NULL);
+
+      /* Unmap the page before checking whether it is dirty, so
+         that the process cannot modify it after we look. */
+      pagedir_clear_page (p->pagedir, p->upage);
+      if (p->type == PAGE_MMAP)
+        write_back (p);
+      else if (p->type == PAGE_SWAP
+               || pagedir_is_dirty (p->pagedir, p->upage)) 
+        {
+          /* Insertion sort by address. */
+          for (j = dirty_cnt; j > 0 && dirty[j - 1]->upage > p->upage; j--)
+            dirty[j] = dirty[j - 1];
+          dirty[j] = p;
+          dirty_cnt++;
+        }
+    }
+
+  if (dirty_cnt > 0) 
+    {
+      size_t slot;
+
+      for (i = 0; i < dirty_cnt; i++)
+        kpages[i] = dirty[i]->frame->kpage;
+      slot = swap_out (kpages, dirty_cnt);
+      if (slot == SWAP_ERROR) 
+        {
+          for (i = 0; i < cnt; i++)
+            pagedir_set_page (pages[i]->pagedir, pages[i]->upage,
+                              pages[i]->frame->kpage, pages[i]->writable);
+          for (i = 0; i < dirty_cnt; i++)
+            pagedir_set_dirty (dirty[i]->pagedir, dirty[i]->upage, true);
+          return false;
+        }
+      for (i = 0; i < dirty_cnt; i++) 
+        {
+          dirty[i]->type = PAGE_SWAP;
+          dirty[i]->swap_slot = slot + i;
+        }
+    }
+  for (i = 0; i < cnt; i++)
+    pages[i]->frame = NULL;
+  return true;
+}
@@ -0,0 +1,70 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+/* Where a page's contents come from the next time it is loaded.
+   A page that has been modified becomes PAGE_SWAP for good, so
+   that every later eviction writes it to swap, except for a
+   PAGE_MMAP page, which is written back to its file instead. */
+enum page_type
+  {
+    PAGE_ZERO,                  /* All zeros. */
+    PAGE_FILE,                  /* Read from a file, zero-padded. */
+    PAGE_SWAP,                  /* Swap slot, unless resident. */
+    PAGE_MMAP                   /* Memory-mapped file, zero-padded. */
+  };
+
+/* A page of a process's virtual address space.  Each process's
+   supplemental page table, a hash table keyed on user virtual
+   address, describes every page it may touch, whether or not the
+   page is currently mapped in its page directory. */
+struct page
+  {
+    void *upage;                /* User virtual address. */
+    uint32_t *pagedir;          /* Owning process's page directory. */
+    struct hash_elem hash_elem; /* Element in thread's `pages'. */
+    enum page_type type;        /* Source of contents. */
+    bool writable;              /* Writable by the process? */
+
+    /* Held while the page is being loaded, evicted, or
+       destroyed. */
+    struct lock lock;
+    struct frame *frame;        /* Frame holding the page, or null. */
+
+    /* PAGE_FILE and PAGE_MMAP only. */
+    struct file *file;          /* File to read. */
+    off_t file_ofs;             /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes to read; the rest are zeroed. */
+
+    /* PAGE_SWAP only. */
+    size_t swap_slot;           /* Swap slot, if not resident. */
+
+    /* PAGE_FILE only.  Pages in a share have their `frame'
+       protected by the share's lock; see vm/share.c. */
+    struct share *share;        /* Share, or null if not shared. */
+    struct list_elem share_elem; /* Element in share's `pages'. */
+  };
+
+void page_init (void);
+struct hash *page_table_create (void);
+void page_table_destroy (struct hash *);
+
+bool page_add_zero (void *upage, bool writable);
+bool page_add_file (void *upage, struct file *, off_t, size_t read_bytes,
+                    bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t, size_t read_bytes);
+void page_remove (void *upage);
+struct page *page_lookup (const void *);
+bool page_read (struct page *, void *kpage);
+bool page_in (void *fault_addr);
+bool page_unshare (void *fault_addr);
+bool page_out (struct page *pages[], size_t cnt);
+
+#endif /* vm/page.h */
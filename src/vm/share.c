@@ -0,0 +1,354 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Sharing of executable pages.
+
+   Every process running a given executable would otherwise read
+   each of its pages into a frame of its own.  Instead, a
+   PAGE_FILE page is entered into a system-wide table of
+   "shares", keyed on the inode, offset, and length of the data
+   it holds, and all the pages with the same key use a single
+   frame, mapped read-only in each of their page directories.
+   The second and later processes to touch such a page thus
+   neither read the file nor use another frame.
+
+   A writable page, one from a program's data segment, is shared
+   only until its process writes to it.  The write faults, since
+   the page is mapped read-only, and page_fault() calls
+   share_break(), which gives the page a private copy of the data
+   and takes it out of its share ("copy on write").  From then on
+   it is an ordinary PAGE_SWAP page.
+
+   A shared frame belongs to its share, not to any one page: its
+   `share' member points back to the share and its `page' member
+   is null.  Evicting it unmaps it from every page in the share.
+   Its data never changes, so it is never written out.
+
+   Locking: a share's `lock' protects its `frame' and the
+   `frame' member of each of its pages.  Adding or removing a
+   page requires both share_lock and the share's lock, acquired
+   in that order, so that either suffices for walking `pages'.
+   A page's own lock is acquired before either. */
+
+/* A set of pages with the same contents. */
+struct share
+  {
+    struct hash_elem elem;      /* Element in `shares'. */
+    struct inode *inode;        /* Inode read from. */
+    off_t ofs;                  /* Offset in INODE. */
+    size_t read_bytes;          /* Bytes read; the rest are zeros. */
+    struct lock lock;           /* Protects FRAME and pages' frames. */
+    struct frame *frame;        /* Shared frame, or null. */
+    struct list pages;          /* Pages in the share. */
+  };
+
+/* All shares. */
+static struct hash shares;
+
+/* Protects `shares' and each share's `pages'. */
+static struct lock share_lock;
+
+/* Cache of `struct share's. */
+static struct kmem_cache share_cache;
+
+/* Statistics. */
+static long long load_cnt;      /* Shared frames read from files. */
+static long long hit_cnt;       /* Pages mapped to resident frames. */
+static long long break_cnt;     /* Pages copied on write. */
+
+static bool share_evict (struct share *);
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Initializes the share table. */
+void
+share_init (void) 
+{
+  hash_init (&shares, share_hash, share_less, NULL);
+  lock_init (&share_lock);
+  kmem_cache_init (&share_cache, "share", sizeof (struct share), NULL);
+}
+
+/* Adds PAGE_FILE page P to the share for the data it reads,
+   creating the share if there is none yet.  Returns true if
+   successful, false, leaving P unshared, if memory is not
+   available. */
+bool
+share_add (struct page *p) 
+{
+  struct share key;
+  struct share *s;
+  struct hash_elem *e;
+
+  ASSERT (p->type == PAGE_FILE);
+  ASSERT (p->share == NULL);
+
+  key.inode = file_get_inode (p->file);
+  key.ofs = p->file_ofs;
+  key.read_bytes = p->read_bytes;
+
+  lock_acquire (&share_lock);
+  e = hash_find (&shares, &key.elem);
+  if (e != NULL)
+    s = hash_entry (e, struct share, elem);
+  else 
+    {
+      s = kmem_cache_alloc (&share_cache);
+      if (s == NULL) 
+        {
+          lock_release (&share_lock);
+          return false;
+        }
+      s->inode = key.inode;
+      s->ofs = key.ofs;
+      s->read_bytes = key.read_bytes;
+      lock_init (&s->lock);
+      s->frame = NULL;
+      list_init (&s->pages);
+      hash_insert (&shares, &s->elem);
+    }
+  lock_acquire (&s->lock);
+  list_push_back (&s->pages, &p->share_elem);
+  lock_release (&s->lock);
+  lock_release (&share_lock);
+
+  p->share = s;
+  return true;
+}
+
+/* Removes page P, whose lock must be held, from its share,
+   unmapping it if it is mapped.  Destroys the share, freeing its
+   frame, if P was its last page. */
+void
+share_remove (struct page *p) 
+{
+  struct share *s = p->share;
+  bool last;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (s != NULL);
+
+  lock_acquire (&share_lock);
+  lock_acquire (&s->lock);
+  if (p->frame != NULL) 
+    {
+      pagedir_clear_page (p->pagedir, p->upage);
+      p->frame = NULL;
+    }
+  list_remove (&p->share_elem);
+  last = list_empty (&s->pages);
+  if (last) 
+    {
+      hash_delete (&shares, &s->elem);
+      if (s->frame != NULL)
+        frame_free (s->frame);
+    }
+  lock_release (&s->lock);
+  lock_release (&share_lock);
+
+  if (last)
+    kmem_cache_free (&share_cache, s);
+  p->share = NULL;
+}
+
+/* Maps page P, whose lock must be held and which must not be
+   mapped, read-only to its share's frame, first reading the
+   frame from the file if it is not resident.  Returns true if
+   successful, false if no frame can be obtained or the file
+   cannot be read. */
+bool
+share_in (struct page *p) 
+{
+  struct share *s = p->share;
+  bool success = false;
+
+  bool loaded = false;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (s != NULL);
+
+  lock_acquire (&s->lock);
+  if (s->frame == NULL) 
+    {
+      struct frame *f = frame_alloc (p, false);
+      if (f == NULL)
+        goto done;
+      if (!page_read (p, f->kpage)) 
+        {
+          frame_free (f);
+          goto done;
+        }
+      frame_set_share (f, s);
+      s->frame = f;
+      loaded = true;
+    }
+
+  if (pagedir_set_page (p->pagedir, p->upage, s->frame->kpage, false)) 
+    {
+      p->frame = s->frame;
+      success = true;
+    }
+
+ done:
+  lock_release (&s->lock);
+  if (success) 
+    {
+      lock_acquire (&share_lock);
+      if (loaded)
+        load_cnt++;
+      else
+        hit_cnt++;
+      lock_release (&share_lock);
+    }
+  return success;
+}
+
+/* Tries to evict share S's frame, on behalf of the clock hand.
+   Returns false if S's lock cannot be acquired without waiting.
+   If any page in S has been accessed since the hand last came
+   by, clears their accessed bits and returns false.  Otherwise,
+   unmaps the frame from every page, detaches it from S, and
+   returns true; the caller takes over the frame. */
+bool
+share_try_evict (struct share *s) 
+{
+  bool success;
+
+  if (lock_held_by_current_thread (&s->lock) || !lock_try_acquire (&s->lock))
+    return false;
+  success = share_evict (s);
+  lock_release (&s->lock);
+  return success;
+}
+
+/* Does the work of share_try_evict() for share S, whose lock must
+   be held. */
+static bool
+share_evict (struct share *s) 
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  ASSERT (lock_held_by_current_thread (&s->lock));
+  ASSERT (s->frame != NULL);
+
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+       e = list_next (e)) 
+    {
+      struct page *p = list_entry (e, struct page, share_elem);
+      if (p->frame != NULL && pagedir_is_accessed (p->pagedir, p->upage)) 
+        {
+          pagedir_set_accessed (p->pagedir, p->upage, false);
+          accessed = true;
+        }
+    }
+  if (accessed)
+    return false;
+
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+       e = list_next (e)) 
+    {
+      struct page *p = list_entry (e, struct page, share_elem);
+      if (p->frame != NULL) 
+        {
+          pagedir_clear_page (p->pagedir, p->upage);
+          p->frame = NULL;
+        }
+    }
+  s->frame = NULL;
+  return true;
+}
+
+/* Gives writable page P, whose lock must be held, a private
+   copy of its share's data, takes it out of the share, and maps
+   it writable.  Returns true if successful, false if no frame
+   can be obtained or the file cannot be read. */
+bool
+share_break (struct page *p) 
+{
+  struct share *s = p->share;
+  struct frame *f;
+  bool copied = false;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (s != NULL);
+  ASSERT (p->writable);
+
+  f = frame_alloc (p, false);
+  if (f == NULL)
+    return false;
+
+  /* Copy the shared frame if it is still resident, otherwise
+     read the data again. */
+  lock_acquire (&s->lock);
+  if (s->frame != NULL) 
+    {
+      memcpy (f->kpage, s->frame->kpage, PGSIZE);
+      copied = true;
+    }
+  lock_release (&s->lock);
+  if (!copied && !page_read (p, f->kpage)) 
+    {
+      frame_free (f);
+      return false;
+    }
+
+  share_remove (p);
+  if (!pagedir_set_page (p->pagedir, p->upage, f->kpage, true)) 
+    {
+      frame_free (f);
+      return false;
+    }
+  p->type = PAGE_SWAP;
+  p->frame = f;
+
+  lock_acquire (&share_lock);
+  break_cnt++;
+  lock_release (&share_lock);
+  return true;
+}
+
+/* Prints sharing statistics. */
+void
+share_print_stats (void) 
+{
+  printf ("Sharing: %zu shares, %lld frames loaded, %lld hits, "
+          "%lld copies on write\n",
+          hash_size (&shares), load_cnt, hit_cnt, break_cnt);
+}
+
+/* Returns a hash value for share S. */
+static unsigned
+share_hash (const struct hash_elem *s_, void *aux UNUSED) 
+{
+  const struct share *s = hash_entry (s_, struct share, elem);
+  unsigned h = hash_bytes (&s->inode, sizeof s->inode);
+  return h ^ hash_int (s->ofs);
+}
+
+/* Returns true if share A precedes share B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED) 
+{
+  const struct share *a = hash_entry (a_, struct share, elem);
+  const struct share *b = hash_entry (b_, struct share, elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else
+    return a->read_bytes < b->read_bytes;
+}
@@ -0,0 +1,17 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <stdbool.h>
+
+struct page;
+struct share;
+
+void share_init (void);
+bool share_add (struct page *);
+void share_remove (struct page *);
+bool share_in (struct page *);
+bool share_try_evict (struct share *);
+bool share_break (struct page *);
+void share_print_stats (void);
+
+#endif /* vm/share.h */
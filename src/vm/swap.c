@@ -0,0 +1,151 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap area.
+
+   The swap block device is divided into page-size "slots", each
+   of which can hold one evicted user page.  A bitmap records
+   which slots are in use.
+
+   Pages move to and from swap in clusters of up to SWAP_CLUSTER
+   pages that occupy adjacent slots, each cluster in a single
+   request to the block device.  Slots are allocated "next fit",
+   starting where the previous allocation ended, so that pages
+   evicted one after another, which tend to belong to the same
+   process, also end up next to each other. */
+
+/* Number of sectors in a swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Swap device, or null if there is none. */
+static struct block *swap_device;
+
+/* Bitmap of slots in use, or null if there is no swap device. */
+static struct bitmap *swap_map;
+
+/* Slot at which to start looking for free slots. */
+static size_t rover;
+
+/* Protects the variables above. */
+static struct lock swap_lock;
+
+/* Statistics. */
+static long long write_cnt;     /* Pages written to swap. */
+static long long write_req_cnt; /* Write requests. */
+static long long read_cnt;      /* Pages read from swap. */
+static long long read_req_cnt;  /* Read requests. */
+
+static void sector_buffers (void *const kpages[], size_t cnt,
+                            void *buffers[]);
+
+/* Initializes the swap area.  Without a swap device, every
+   swap_out() fails. */
+void
+swap_init (void) 
+{
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+
+  swap_map = bitmap_create (block_size (swap_device) / SECTORS_PER_SLOT);
+  if (swap_map == NULL)
+    PANIC ("swap: bitmap creation failed--swap device is too large");
+}
+
+/* Writes the CNT pages in KPAGES, where CNT is between 1 and
+   SWAP_CLUSTER, to CNT adjacent free swap slots, in order, and
+   returns the first slot.  Returns SWAP_ERROR if there is no run
+   of CNT free slots. */
+size_t
+swap_out (void *const kpages[], size_t cnt) 
+{
+  void *buffers[SWAP_CLUSTER * SECTORS_PER_SLOT];
+  size_t slot;
+
+  ASSERT (cnt >= 1 && cnt <= SWAP_CLUSTER);
+
+  if (swap_map == NULL)
+    return SWAP_ERROR;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_map, rover, cnt, false);
+  if (slot == BITMAP_ERROR && rover > 0)
+    slot = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+  if (slot != BITMAP_ERROR) 
+    {
+      rover = slot + cnt;
+      write_cnt += cnt;
+      write_req_cnt++;
+    }
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_ERROR;
+
+  sector_buffers (kpages, cnt, buffers);
+  block_write_multiple (swap_device, slot * SECTORS_PER_SLOT,
+                        (const void *const *) buffers,
+                        cnt * SECTORS_PER_SLOT);
+  return slot;
+}
+
+/* Reads the CNT pages in the adjacent swap slots starting at
+   SLOT, where CNT is between 1 and SWAP_CLUSTER, into KPAGES, in
+   order.  The slots stay in use until freed with swap_free(). */
+void
+swap_in (size_t slot, void *const kpages[], size_t cnt) 
+{
+  void *buffers[SWAP_CLUSTER * SECTORS_PER_SLOT];
+
+  ASSERT (swap_map != NULL);
+  ASSERT (cnt >= 1 && cnt <= SWAP_CLUSTER);
+
+  sector_buffers (kpages, cnt, buffers);
+  block_read_multiple (swap_device, slot * SECTORS_PER_SLOT, buffers,
+                       cnt * SECTORS_PER_SLOT);
+
+  lock_acquire (&swap_lock);
+  read_cnt += cnt;
+  read_req_cnt++;
+  lock_release (&swap_lock);
+}
+
+/* Frees swap slot SLOT. */
+void
+swap_free (size_t slot) 
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_map, slot));
+  bitmap_reset (swap_map, slot);
+  lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) 
+{
+  if (swap_map != NULL)
+    printf ("Swap: %lld pages written in %lld requests, "
+            "%lld read in %lld requests, %zu of %zu slots in use\n",
+            write_cnt, write_req_cnt, read_cnt, read_req_cnt,
+            bitmap_count (swap_map, 0, bitmap_size (swap_map), true),
+            bitmap_size (swap_map));
+}
+
+/* Stores in BUFFERS the address of each sector-size piece of the
+   CNT pages in KPAGES, in order. */
+static void
+sector_buffers (void *const kpages[], size_t cnt, void *buffers[]) 
+{
+  size_t i;
+  int j;
+
+  for (i = 0; i < cnt; i++)
+    for (j = 0; j < SECTORS_PER_SLOT; j++)
+      *buffers++ = (uint8_t *) kpages[i] + j * BLOCK_SECTOR_SIZE;
+}
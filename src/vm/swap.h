@@ -0,0 +1,18 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+
+/* Returned by swap_out() when no swap slot is free. */
+#define SWAP_ERROR ((size_t) -1)
+
+/* Most pages that swap_out() and swap_in() transfer at once. */
+#define SWAP_CLUSTER 8
+
+void swap_init (void);
+size_t swap_out (void *const kpages[], size_t cnt);
+void swap_in (size_t slot, void *const kpages[], size_t cnt);
+void swap_free (size_t slot);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */